@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+
+// Bump allocator: hands out memory from big blocks, never reuses it,
+// and gives everything back at once when the arena dies.
+struct arena {
+    explicit arena(size_t block_size = 64 * 1024) noexcept : block_size_(block_size) {}
+
+    arena(arena const &) = delete;
+
+    arena &operator=(arena const &) = delete;
+
+    ~arena() {
+        while (head_) {
+            block *next = head_->next;
+            std::free(head_);
+            head_ = next;
+        }
+    }
+
+    void *allocate(size_t bytes, size_t align) {
+        uintptr_t ptr = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t) (align - 1);
+        if (!cur_ || ptr > reinterpret_cast<uintptr_t>(end_) || bytes > reinterpret_cast<uintptr_t>(end_) - ptr) {
+            add_block(bytes + align);
+            ptr = (reinterpret_cast<uintptr_t>(cur_) + align - 1) & ~(uintptr_t) (align - 1);
+        }
+        cur_ = reinterpret_cast<char *>(ptr + bytes);
+        used_ += bytes;
+        return reinterpret_cast<void *>(ptr);
+    }
+
+    // Bytes handed out so far (nothing is ever returned before destruction)
+    size_t bytes_allocated() const noexcept {
+        return used_;
+    }
+
+private:
+    struct block {
+        block *next;
+    };
+
+    void add_block(size_t min_bytes) {
+        size_t bytes = std::max(block_size_, min_bytes) + sizeof(block);
+        block *b = static_cast<block *>(std::malloc(bytes));
+        if (!b) {
+            throw std::bad_alloc();
+        }
+        b->next = head_;
+        head_ = b;
+        cur_ = reinterpret_cast<char *>(b + 1);
+        end_ = reinterpret_cast<char *>(b) + bytes;
+    }
+
+    size_t block_size_;
+    block *head_ = nullptr;
+    char *cur_ = nullptr;
+    char *end_ = nullptr;
+    size_t used_ = 0;
+};
+
+// Stateful allocator over an arena; deallocate() is a no-op.
+// Moves and swaps take the arena along, copy assignment keeps the target's arena.
+template<typename T>
+struct arena_allocator {
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    arena_allocator(arena &a) noexcept : arena_(&a) {}
+
+    template<typename U>
+    arena_allocator(arena_allocator<U> const &other) noexcept : arena_(&other.get_arena()) {}
+
+    arena &get_arena() const noexcept {
+        return *arena_;
+    }
+
+    T *allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T *, size_t) noexcept {}
+
+    template<typename U>
+    friend bool operator==(arena_allocator const &a, arena_allocator<U> const &b) noexcept {
+        return &a.get_arena() == &b.get_arena();
+    }
+
+    template<typename U>
+    friend bool operator!=(arena_allocator const &a, arena_allocator<U> const &b) noexcept {
+        return &a.get_arena() != &b.get_arena();
+    }
+
+private:
+    arena *arena_;
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include "vector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// Grow-only vector that many threads may append to at once without locks. An
+// append makes sure the chunk for the next index exists, claims the index with a
+// compare-and-swap, then constructs the element in a chain of chunks of
+// FirstChunk, 2 * FirstChunk... slots: chunks are never
+// reallocated, so nothing moves and readers never wait. Each slot carries a
+// state byte; an element may be read once is_published() says so, which the
+// thread that appended it can also learn from the returned index. snapshot()
+// copies the published prefix into an ordinary vector.
+template<typename T, size_t FirstChunk = 64>
+struct concurrent_vector {
+    static_assert(FirstChunk != 0 && (FirstChunk & (FirstChunk - 1)) == 0, "FirstChunk must be a power of two");
+
+    typedef T value_type;
+
+    concurrent_vector() = default;
+
+    concurrent_vector(concurrent_vector const &) = delete;
+
+    concurrent_vector &operator=(concurrent_vector const &) = delete;
+
+    // Appends must have finished
+    ~concurrent_vector() {
+        size_t n = std::min(claimed_.load(std::memory_order_acquire), max_size());
+        for (size_t i = 0; i != n; ++i) {
+            position p = locate(i);
+            unsigned char *block = chunks_[p.chunk].load(std::memory_order_relaxed);
+            if (block && states(block, p.chunk)[p.offset].load(std::memory_order_relaxed) == published) {
+                std::destroy_at(elements(block) + p.offset);
+            }
+        }
+        for (unsigned k = 0; k != max_chunks; ++k) {
+            if (unsigned char *block = chunks_[k].load(std::memory_order_relaxed)) {
+                free_chunk(block, k);
+            }
+        }
+    }
+
+    // Slots claimed so far; the last ones may still be under construction
+    size_t size() const noexcept {
+        return std::min(claimed_.load(std::memory_order_acquire), max_size());
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    static constexpr size_t max_size() noexcept {
+        return chunk_size(max_chunks) - FirstChunk;
+    }
+
+    // Returns the index of the element. A chunk that cannot be allocated leaves
+    // nothing claimed; a constructor that throws leaves a dead slot for snapshot()
+    // to skip. Indices are only claimed in chunks that exist, since a claimed slot
+    // without a chunk would stay pending and hide every later element.
+    template<typename... Args>
+    size_t emplace_back(Args &&... args) {
+        size_t index = claimed_.load(std::memory_order_relaxed);
+        position p;
+        unsigned char *block;
+        do {
+            if (index >= max_size()) {
+                throw std::length_error("concurrent_vector is too big");
+            }
+            p = locate(index);
+            block = chunk(p.chunk);
+        } while (!claimed_.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+        std::atomic<unsigned char> &state = states(block, p.chunk)[p.offset];
+        try {
+            new(elements(block) + p.offset) T(std::forward<Args>(args)...);
+        } catch (...) {
+            // readers and snapshot() skip the slot
+            state.store(dead, std::memory_order_release);
+            throw;
+        }
+        state.store(published, std::memory_order_release);
+        return index;
+    }
+
+    size_t push_back(T const &value) {
+        return emplace_back(value);
+    }
+
+    size_t push_back(T &&value) {
+        return emplace_back(std::move(value));
+    }
+
+    bool is_published(size_t index) const noexcept {
+        if (index >= size()) {
+            return false;
+        }
+        position p = locate(index);
+        unsigned char *block = chunks_[p.chunk].load(std::memory_order_acquire);
+        return block && states(block, p.chunk)[p.offset].load(std::memory_order_acquire) == published;
+    }
+
+    // The element must be published
+    T const &operator[](size_t index) const noexcept {
+        position p = locate(index);
+        return elements(chunks_[p.chunk].load(std::memory_order_acquire))[p.offset];
+    }
+
+    T const &at(size_t index) const {
+        if (!is_published(index)) {
+            throw std::runtime_error("concurrent_vector element is not published");
+        }
+        return (*this)[index];
+    }
+
+    // Copies the elements up to the first slot still under construction, skipping
+    // slots whose constructor threw
+    template<typename Vector = vector<T>>
+    Vector snapshot() const {
+        size_t n = size();
+        Vector result;
+        result.reserve(n);
+        for (size_t i = 0; i != n; ++i) {
+            position p = locate(i);
+            unsigned char *block = chunks_[p.chunk].load(std::memory_order_acquire);
+            unsigned char state = block ? states(block, p.chunk)[p.offset].load(std::memory_order_acquire) : pending;
+            if (state == pending) {
+                break;
+            }
+            if (state == published) {
+                result.push_back(elements(block)[p.offset]);
+            }
+        }
+        return result;
+    }
+
+private:
+    enum : unsigned char {
+        pending = 0,
+        published = 1,
+        dead = 2,
+    };
+
+    static constexpr unsigned first_bits = __builtin_ctzll(FirstChunk);
+    // the last chunk would make max_size() overflow
+    static constexpr unsigned max_chunks = sizeof(size_t) * 8 - first_bits - 1;
+
+    static constexpr size_t chunk_size(unsigned k) noexcept {
+        return FirstChunk << k;
+    }
+
+    struct position {
+        unsigned chunk;
+        size_t offset;
+    };
+
+    static position locate(size_t index) noexcept {
+        size_t j = index + FirstChunk;
+        unsigned k = (unsigned) (sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(j)) - first_bits;
+        return {k, j - chunk_size(k)};
+    }
+
+    // A chunk holds its elements, then one state byte per element
+    static constexpr std::align_val_t chunk_alignment{std::max(alignof(T), alignof(std::atomic<unsigned char>))};
+
+    static T *elements(unsigned char *block) noexcept {
+        return std::launder(reinterpret_cast<T *>(block));
+    }
+
+    static std::atomic<unsigned char> *states(unsigned char *block, unsigned k) noexcept {
+        return std::launder(reinterpret_cast<std::atomic<unsigned char> *>(block + sizeof(T) * chunk_size(k)));
+    }
+
+    static size_t chunk_bytes(unsigned k) noexcept {
+        return (sizeof(T) + sizeof(std::atomic<unsigned char>)) * chunk_size(k);
+    }
+
+    static void free_chunk(unsigned char *block, unsigned k) noexcept {
+        std::destroy_n(states(block, k), chunk_size(k));
+        ::operator delete(block, chunk_bytes(k), chunk_alignment);
+    }
+
+    // Threads that reach an absent chunk at once race to install theirs; losers free their copy
+    unsigned char *chunk(unsigned k) {
+        unsigned char *block = chunks_[k].load(std::memory_order_acquire);
+        if (block) {
+            return block;
+        }
+        if (chunk_size(k) > std::numeric_limits<size_t>::max() / (sizeof(T) + sizeof(std::atomic<unsigned char>))) {
+            throw std::bad_alloc();
+        }
+        unsigned char *fresh = static_cast<unsigned char *>(::operator new(chunk_bytes(k), chunk_alignment));
+        std::atomic<unsigned char> *state = reinterpret_cast<std::atomic<unsigned char> *>(fresh + sizeof(T) * chunk_size(k));
+        for (size_t i = 0; i != chunk_size(k); ++i) {
+            new(state + i) std::atomic<unsigned char>(pending);
+        }
+        if (chunks_[k].compare_exchange_strong(block, fresh, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            return fresh;
+        }
+        free_chunk(fresh, k);
+        return block;
+    }
+
+    std::atomic<size_t> claimed_{0};
+    std::atomic<unsigned char *> chunks_[max_chunks] = {};
+};
@@ -1,5 +1,6 @@
 #include "fault_injection.h"
 #include <cassert>
+#include <cstdlib>
 #include <iostream>
 #include <vector>
 
@@ -162,6 +163,40 @@ void* operator new[](std::size_t count)
     return ptr;
 }
 
+void* operator new(std::size_t count, std::nothrow_t const&) noexcept
+{
+    if (should_inject_fault())
+        return nullptr;
+
+    return malloc(count);
+}
+
+void* operator new[](std::size_t count, std::nothrow_t const&) noexcept
+{
+    if (should_inject_fault())
+        return nullptr;
+
+    return malloc(count);
+}
+
+void* operator new(std::size_t count, std::align_val_t al)
+{
+    if (should_inject_fault())
+        throw std::bad_alloc();
+
+    size_t align = static_cast<size_t>(al);
+    void* ptr = aligned_alloc(align, (count + align - 1) / align * align);
+    if (!ptr)
+        throw std::bad_alloc();
+
+    return ptr;
+}
+
+void* operator new[](std::size_t count, std::align_val_t al)
+{
+    return operator new(count, al);
+}
+
 void operator delete(void* ptr) noexcept
 {
     free(ptr);
@@ -181,3 +216,23 @@ void operator delete[](void* ptr, std::size_t) noexcept
 {
     free(ptr);
 }
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    free(ptr);
+}
+
+void operator delete[](void* ptr, std::size_t, std::align_val_t) noexcept
+{
+    free(ptr);
+}
@@ -0,0 +1,241 @@
+#pragma once
+
+#include "flat_set.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+// Map stored as a vector of pairs sorted by key, with the lookup, bulk insert and
+// sharing behaviour of flat_set. Iteration is read-only, since a mutable
+// iterator would copy shared storage up front; at(), operator[] and
+// insert_or_assign reach the mapped values.
+template<typename Key, typename T, typename Compare = std::less<Key>, typename Vector = vector<std::pair<Key, T>>>
+struct flat_map {
+    typedef Key key_type;
+    typedef T mapped_type;
+    typedef std::pair<Key, T> value_type;
+    typedef Compare key_compare;
+    typedef Vector container_type;
+    typedef typename Vector::const_iterator iterator;
+    typedef typename Vector::const_iterator const_iterator;
+
+    flat_map() = default;
+
+    explicit flat_map(Compare const &comp) : comp_(comp) {}
+
+    explicit flat_map(Vector elems, Compare const &comp = Compare()) : elems_(std::move(elems)), comp_(comp) {
+        merge_tail(0);
+    }
+
+    flat_map(sorted_unique_t, Vector elems, Compare const &comp = Compare()) : elems_(std::move(elems)), comp_(comp) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    flat_map(InputIterator first, InputIterator last, Compare const &comp = Compare()) : comp_(comp) {
+        insert(first, last);
+    }
+
+    flat_map(std::initializer_list<value_type> init, Compare const &comp = Compare())
+            : flat_map(init.begin(), init.end(), comp) {}
+
+    size_t size() const noexcept {
+        return elems_.size();
+    }
+
+    bool empty() const noexcept {
+        return elems_.empty();
+    }
+
+    const_iterator begin() const noexcept {
+        return elems_.begin();
+    }
+
+    const_iterator end() const noexcept {
+        return elems_.end();
+    }
+
+    Vector const &sequence() const noexcept {
+        return elems_;
+    }
+
+    // Hands the sorted vector over and leaves the map empty
+    Vector extract() {
+        Vector result = std::move(elems_);
+        elems_.clear();
+        return result;
+    }
+
+    key_compare key_comp() const {
+        return comp_;
+    }
+
+    void reserve(size_t cap) {
+        elems_.reserve(cap);
+    }
+
+    template<typename K>
+    const_iterator lower_bound(K const &key) const {
+        return flat_partition_point(elems_.data(), elems_.size(), [this, &key](value_type const &elem) {
+            return comp_(elem.first, key);
+        });
+    }
+
+    template<typename K>
+    const_iterator upper_bound(K const &key) const {
+        return flat_partition_point(elems_.data(), elems_.size(), [this, &key](value_type const &elem) {
+            return !comp_(key, elem.first);
+        });
+    }
+
+    template<typename K>
+    std::pair<const_iterator, const_iterator> equal_range(K const &key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template<typename K>
+    const_iterator find(K const &key) const {
+        const_iterator it = lower_bound(key);
+        return it != end() && !comp_(key, it->first) ? it : end();
+    }
+
+    template<typename K>
+    bool contains(K const &key) const {
+        return find(key) != end();
+    }
+
+    template<typename K>
+    size_t count(K const &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    template<typename K>
+    T const &at(K const &key) const {
+        const_iterator it = find(key);
+        if (it == end()) {
+            throw std::runtime_error("flat_map has no such key");
+        }
+        return it->second;
+    }
+
+    // Copies shared storage, like any write
+    template<typename K>
+    T &at(K const &key) {
+        size_t index = std::as_const(*this).find(key) - begin();
+        if (index == size()) {
+            throw std::runtime_error("flat_map has no such key");
+        }
+        return elems_.data()[index].second;
+    }
+
+    T &operator[](Key const &key) {
+        size_t index = try_emplace(key).first - begin();
+        return elems_.data()[index].second;
+    }
+
+    T &operator[](Key &&key) {
+        size_t index = try_emplace(std::move(key)).first - begin();
+        return elems_.data()[index].second;
+    }
+
+    // Leaves args alone when the key is present
+    template<typename K, typename... Args>
+    std::pair<const_iterator, bool> try_emplace(K &&key, Args &&... args) {
+        size_t index = lower_bound(key) - begin();
+        if (index != size() && !comp_(key, elems_.unchecked_at(index).first)) {
+            return {begin() + index, false};
+        }
+        elems_.emplace(std::as_const(elems_).begin() + index, std::piecewise_construct,
+                       std::forward_as_tuple(std::forward<K>(key)), std::forward_as_tuple(std::forward<Args>(args)...));
+        return {begin() + index, true};
+    }
+
+    template<typename K, typename M>
+    std::pair<const_iterator, bool> insert_or_assign(K &&key, M &&value) {
+        std::pair<const_iterator, bool> result = try_emplace(std::forward<K>(key), std::forward<M>(value));
+        if (result.second) {
+            return result;
+        }
+        size_t index = result.first - begin();
+        elems_.data()[index].second = std::forward<M>(value);
+        return {begin() + index, false};
+    }
+
+    std::pair<const_iterator, bool> insert(value_type const &value) {
+        return try_emplace(value.first, value.second);
+    }
+
+    std::pair<const_iterator, bool> insert(value_type &&value) {
+        return try_emplace(std::move(value.first), std::move(value.second));
+    }
+
+    // O(n + k log k) for k new elements; among equal keys the first one wins
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    void insert(InputIterator first, InputIterator last) {
+        size_t old = size();
+        elems_.insert(std::as_const(elems_).end(), first, last);
+        merge_tail(old);
+    }
+
+    void insert(std::initializer_list<value_type> init) {
+        insert(init.begin(), init.end());
+    }
+
+    template<typename K>
+    size_t erase(K const &key) {
+        const_iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    const_iterator erase(const_iterator pos) {
+        size_t index = pos - begin();
+        elems_.erase(pos);
+        return begin() + index;
+    }
+
+    const_iterator erase(const_iterator first, const_iterator last) {
+        size_t index = first - begin();
+        elems_.erase(first, last);
+        return begin() + index;
+    }
+
+    void clear() {
+        elems_.clear();
+    }
+
+    void swap(flat_map &other) noexcept {
+        using std::swap;
+        swap(elems_, other.elems_);
+        swap(comp_, other.comp_);
+    }
+
+    friend void swap(flat_map &a, flat_map &b) noexcept {
+        a.swap(b);
+    }
+
+    friend bool operator==(flat_map const &a, flat_map const &b) {
+        return a.elems_ == b.elems_;
+    }
+
+    friend bool operator!=(flat_map const &a, flat_map const &b) {
+        return !(a == b);
+    }
+
+private:
+    void merge_tail(size_t old) {
+        flat_merge_tail(elems_, old, [this](value_type const &a, value_type const &b) {
+            return comp_(a.first, b.first);
+        });
+    }
+
+    Vector elems_;
+    Compare comp_;
+};
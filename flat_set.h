@@ -0,0 +1,279 @@
+#pragma once
+
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+// Tag for constructors that take a sequence already sorted and free of duplicates
+struct sorted_unique_t {
+    explicit sorted_unique_t() = default;
+};
+
+inline constexpr sorted_unique_t sorted_unique{};
+
+// First of the n elements for which before(elem) is false, assuming they are
+// partitioned. The trip count depends on n only and the step is a conditional
+// move, so a lookup does not pay for branch mispredictions.
+template<typename T, typename Before>
+T const *flat_partition_point(T const *first, size_t n, Before before) {
+    if (n == 0) {
+        return first;
+    }
+    while (n > 1) {
+        size_t half = n / 2;
+        first = before(first[half - 1]) ? first + half : first;
+        n -= half;
+    }
+    return first + (before(*first) ? 1 : 0);
+}
+
+// Sorts elems[old, size()) by less, merges it into the sorted prefix and drops
+// elements equivalent to an earlier one, so on equal keys the prefix wins, then
+// the earlier element of the tail. The buffered std::stable_sort and
+// std::inplace_merge lose elements when a move throws, so types with such moves
+// sort indices and merge into a new vector, which leaves the prefix alone on failure.
+// Otherwise a comparison that throws mid-merge leaves elems empty.
+template<typename Vector, typename Less>
+void flat_merge_tail(Vector &elems, size_t old, Less less) {
+    typedef typename Vector::value_type T;
+    if (old == elems.size()) {
+        return;
+    }
+    auto equivalent = [&less](T const &a, T const &b) {
+        return !less(a, b);
+    };
+    if constexpr (std::is_nothrow_move_constructible_v<T> && std::is_nothrow_move_assignable_v<T>) {
+        try {
+            span<T> s = elems.mutable_span();
+            T *mid = s.begin() + old;
+            std::stable_sort(mid, s.end(), less);
+            std::inplace_merge(s.begin(), mid, s.end(), less);
+            T *last = std::unique(s.begin(), s.end(), equivalent);
+            elems.erase(std::as_const(elems).begin() + (last - s.begin()), std::as_const(elems).end());
+        } catch (...) {
+            elems.clear();
+            throw;
+        }
+    } else {
+        try {
+            T const *data = std::as_const(elems).data();
+            size_t n = elems.size();
+            vector<size_t> order;
+            order.reserve(n - old);
+            for (size_t i = old; i != n; ++i) {
+                order.push_back(i);
+            }
+            span<size_t> tail = order.mutable_span();
+            std::sort(tail.begin(), tail.end(), [data, &less](size_t a, size_t b) {
+                return less(data[a], data[b]) || (!less(data[b], data[a]) && a < b);
+            });
+            Vector merged;
+            merged.reserve(n);
+            size_t const *next = tail.begin();
+            for (size_t i = 0; i != old || next != tail.end();) {
+                T const &elem = next == tail.end() || (i != old && !less(data[*next], data[i])) ? data[i++] : data[*next++];
+                if (merged.empty() || less(std::as_const(merged).back(), elem)) {
+                    merged.push_back(elem);
+                }
+            }
+            elems = std::move(merged);
+        } catch (...) {
+            elems.erase(std::as_const(elems).begin() + old, std::as_const(elems).end());
+            throw;
+        }
+    }
+}
+
+// Set stored as a sorted vector. Lookups binary-search the const view of the
+// vector, so they never copy shared storage, and copies of the set share it.
+// insert(first, last) appends the batch, then sorts and merges it in once
+// (see flat_merge_tail for what a throwing comparison or move leaves behind).
+template<typename Key, typename Compare = std::less<Key>, typename Vector = vector<Key>>
+struct flat_set {
+    typedef Key key_type;
+    typedef Key value_type;
+    typedef Compare key_compare;
+    typedef Vector container_type;
+    typedef typename Vector::const_iterator iterator;
+    typedef typename Vector::const_iterator const_iterator;
+
+    flat_set() = default;
+
+    explicit flat_set(Compare const &comp) : comp_(comp) {}
+
+    explicit flat_set(Vector elems, Compare const &comp = Compare()) : elems_(std::move(elems)), comp_(comp) {
+        merge_tail(0);
+    }
+
+    flat_set(sorted_unique_t, Vector elems, Compare const &comp = Compare()) : elems_(std::move(elems)), comp_(comp) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    flat_set(InputIterator first, InputIterator last, Compare const &comp = Compare()) : comp_(comp) {
+        insert(first, last);
+    }
+
+    flat_set(std::initializer_list<Key> init, Compare const &comp = Compare()) : flat_set(init.begin(), init.end(), comp) {}
+
+    size_t size() const noexcept {
+        return elems_.size();
+    }
+
+    bool empty() const noexcept {
+        return elems_.empty();
+    }
+
+    const_iterator begin() const noexcept {
+        return elems_.begin();
+    }
+
+    const_iterator end() const noexcept {
+        return elems_.end();
+    }
+
+    Vector const &sequence() const noexcept {
+        return elems_;
+    }
+
+    // Hands the sorted vector over and leaves the set empty
+    Vector extract() {
+        Vector result = std::move(elems_);
+        elems_.clear();
+        return result;
+    }
+
+    key_compare key_comp() const {
+        return comp_;
+    }
+
+    void reserve(size_t cap) {
+        elems_.reserve(cap);
+    }
+
+    template<typename K>
+    const_iterator lower_bound(K const &key) const {
+        return flat_partition_point(elems_.data(), elems_.size(), [this, &key](Key const &elem) {
+            return comp_(elem, key);
+        });
+    }
+
+    template<typename K>
+    const_iterator upper_bound(K const &key) const {
+        return flat_partition_point(elems_.data(), elems_.size(), [this, &key](Key const &elem) {
+            return !comp_(key, elem);
+        });
+    }
+
+    template<typename K>
+    std::pair<const_iterator, const_iterator> equal_range(K const &key) const {
+        return {lower_bound(key), upper_bound(key)};
+    }
+
+    template<typename K>
+    const_iterator find(K const &key) const {
+        const_iterator it = lower_bound(key);
+        return it != end() && !comp_(key, *it) ? it : end();
+    }
+
+    template<typename K>
+    bool contains(K const &key) const {
+        return find(key) != end();
+    }
+
+    template<typename K>
+    size_t count(K const &key) const {
+        return contains(key) ? 1 : 0;
+    }
+
+    std::pair<const_iterator, bool> insert(Key const &key) {
+        return emplace(key);
+    }
+
+    std::pair<const_iterator, bool> insert(Key &&key) {
+        return emplace(std::move(key));
+    }
+
+    template<typename... Args>
+    std::pair<const_iterator, bool> emplace(Args &&... args) {
+        Key key(std::forward<Args>(args)...);
+        size_t index = lower_bound(key) - begin();
+        if (index != size() && !comp_(key, elems_.unchecked_at(index))) {
+            return {begin() + index, false};
+        }
+        elems_.insert(std::as_const(elems_).begin() + index, std::move(key));
+        return {begin() + index, true};
+    }
+
+    // O(n + k log k) for k new elements, whatever their order
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    void insert(InputIterator first, InputIterator last) {
+        size_t old = size();
+        elems_.insert(std::as_const(elems_).end(), first, last);
+        merge_tail(old);
+    }
+
+    void insert(std::initializer_list<Key> init) {
+        insert(init.begin(), init.end());
+    }
+
+    template<typename K>
+    size_t erase(K const &key) {
+        const_iterator it = find(key);
+        if (it == end()) {
+            return 0;
+        }
+        erase(it);
+        return 1;
+    }
+
+    const_iterator erase(const_iterator pos) {
+        size_t index = pos - begin();
+        elems_.erase(pos);
+        return begin() + index;
+    }
+
+    const_iterator erase(const_iterator first, const_iterator last) {
+        size_t index = first - begin();
+        elems_.erase(first, last);
+        return begin() + index;
+    }
+
+    void clear() {
+        elems_.clear();
+    }
+
+    void swap(flat_set &other) noexcept {
+        using std::swap;
+        swap(elems_, other.elems_);
+        swap(comp_, other.comp_);
+    }
+
+    friend void swap(flat_set &a, flat_set &b) noexcept {
+        a.swap(b);
+    }
+
+    friend bool operator==(flat_set const &a, flat_set const &b) {
+        return a.elems_ == b.elems_;
+    }
+
+    friend bool operator!=(flat_set const &a, flat_set const &b) {
+        return !(a == b);
+    }
+
+    friend bool operator<(flat_set const &a, flat_set const &b) {
+        return a.elems_ < b.elems_;
+    }
+
+private:
+    void merge_tail(size_t old) {
+        flat_merge_tail(elems_, old, comp_);
+    }
+
+    Vector elems_;
+    Compare comp_;
+};
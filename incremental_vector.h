@@ -0,0 +1,338 @@
+#pragma once
+
+#include "index_iterator.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Elements each push_back must migrate so that a migration ends before the next
+// growth: growing from n leaves k = grow(n) - n free slots, and Step * k >= n.
+// Only geometric policies have such a bound; capped_growth does not, since k stops
+// growing with n. Specialize this for other policies.
+template<typename Growth>
+struct incremental_step {
+    static_assert(!std::is_same_v<Growth, Growth>, "incremental_vector needs a geometric growth policy");
+};
+
+template<>
+struct incremental_step<doubling_growth> {
+    static constexpr size_t value = 1;
+};
+
+// grow(n) - n is (n - 1) / 2 for odd n
+template<>
+struct incremental_step<one_and_half_growth> {
+    static constexpr size_t value = 3;
+};
+
+// Vector that spreads the cost of growth: when it runs out of room it allocates
+// the bigger block and moves over only Step elements per following push_back,
+// serving reads from both blocks meanwhile, like incremental rehashing. Step
+// defaults to incremental_step<Growth>, the least that ends each migration before
+// the next growth, so no push_back moves more than Step + 1 elements. A move that
+// throws during migration is swallowed and retried by later calls, but that push
+// made no progress: the migration may then still run at the next growth, which
+// finishes it with one O(n) finish_migration(). Indexing costs one extra compare.
+// Copies are deep and come out in a single block.
+template<typename T, size_t Step = 0, typename Allocator = std::allocator<T>, typename Growth = doubling_growth>
+struct incremental_vector : private allocator_holder<Allocator> {
+    static constexpr size_t step = Step ? Step : incremental_step<Growth>::value;
+    static_assert(step >= incremental_step<Growth>::value, "Step is too small for Growth to end a migration in time");
+
+    typedef T value_type;
+    typedef Allocator allocator_type;
+    typedef index_iterator<incremental_vector> iterator;
+    typedef index_iterator<incremental_vector const> const_iterator;
+
+    incremental_vector() = default;
+
+    explicit incremental_vector(Allocator const &alloc) noexcept : allocator_holder<Allocator>(alloc) {}
+
+    incremental_vector(std::initializer_list<T> init, Allocator const &alloc = Allocator())
+            : incremental_vector(init.begin(), init.end(), alloc) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    incremental_vector(InputIterator beg, InputIterator en, Allocator const &alloc = Allocator())
+            : incremental_vector(alloc) {
+        if constexpr (is_forward_iterator<InputIterator>) {
+            reserve((size_t) std::distance(beg, en));
+        }
+        for (; beg != en; ++beg) {
+            emplace_back(*beg);
+        }
+    }
+
+    incremental_vector(incremental_vector const &other)
+            : incremental_vector(traits::select_on_container_copy_construction(other.get_allocator())) {
+        reserve(other.size_);
+        for (size_t i = 0; i != other.size_; ++i) {
+            emplace_back(other[i]);
+        }
+    }
+
+    incremental_vector(incremental_vector &&other) noexcept : allocator_holder<Allocator>(other.allocator()) {
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(old_, other.old_);
+        std::swap(old_capacity_, other.old_capacity_);
+        std::swap(old_size_, other.old_size_);
+        std::swap(migrated_, other.migrated_);
+    }
+
+    incremental_vector &operator=(incremental_vector const &other) {
+        if (this != &other) {
+            incremental_vector(other).swap(*this);
+        }
+        return *this;
+    }
+
+    incremental_vector &operator=(incremental_vector &&other) noexcept {
+        incremental_vector(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~incremental_vector() {
+        clear();
+        if (data_) {
+            traits::deallocate(this->allocator(), data_, capacity_);
+        }
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return this->allocator();
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    size_t capacity() const noexcept {
+        return capacity_;
+    }
+
+    // True while elements still wait in the old block
+    bool migrating() const noexcept {
+        return old_ != nullptr;
+    }
+
+    T &operator[](size_t index) noexcept {
+        return *slot(index);
+    }
+
+    T const &operator[](size_t index) const noexcept {
+        return *const_cast<incremental_vector *>(this)->slot(index);
+    }
+
+    T &front() noexcept {
+        return (*this)[0];
+    }
+
+    T const &front() const noexcept {
+        return (*this)[0];
+    }
+
+    T &back() noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    T const &back() const noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    iterator begin() noexcept {
+        return iterator(this, 0);
+    }
+
+    iterator end() noexcept {
+        return iterator(this, size_);
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const noexcept {
+        return const_iterator(this, size_);
+    }
+
+    void push_back(T const &value) {
+        emplace_back(value);
+    }
+
+    void push_back(T &&value) {
+        emplace_back(std::move(value));
+    }
+
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (size_ == capacity_) {
+            if (old_) {
+                // only when a migrating move threw; args may refer to an element it moves
+                T elem(std::forward<Args>(args)...);
+                finish_migration();
+                return emplace_back(std::move(elem));
+            }
+            size_t cp = std::max(Growth::grow(capacity_), size_ + 1);
+            T *block = traits::allocate(this->allocator(), cp);
+            try {
+                // nothing has moved yet, so args may still refer to our elements
+                traits::construct(this->allocator(), block + size_, std::forward<Args>(args)...);
+            } catch (...) {
+                traits::deallocate(this->allocator(), block, cp);
+                throw;
+            }
+            if (size_ != 0) {
+                old_ = data_;
+                old_capacity_ = capacity_;
+                old_size_ = size_;
+                migrated_ = 0;
+            } else if (data_) {
+                traits::deallocate(this->allocator(), data_, capacity_);
+            }
+            data_ = block;
+            capacity_ = cp;
+        } else {
+            traits::construct(this->allocator(), data_ + size_, std::forward<Args>(args)...);
+        }
+        T &result = data_[size_];
+        ++size_;
+        try {
+            migrate(step);
+        } catch (...) {
+            // the element is in; a copy that failed is retried by the next call
+        }
+        return result;
+    }
+
+    void pop_back() {
+        if (size_ == 0) {
+            throw std::runtime_error("attempt to pop_back in empty incremental_vector");
+        }
+        --size_;
+        traits::destroy(this->allocator(), slot(size_));
+        if (old_ && size_ < old_size_) {
+            old_size_ = size_;
+            if (migrated_ == old_size_) {
+                release_old();
+            }
+        }
+    }
+
+    void clear() noexcept {
+        while (size_ != 0) {
+            --size_;
+            traits::destroy(this->allocator(), slot(size_));
+        }
+        if (old_) {
+            release_old();
+        }
+    }
+
+    // Moves whatever is still in the old block; O(n), for callers that can afford it now
+    void finish_migration() {
+        if (old_) {
+            migrate(old_size_ - migrated_);
+        }
+    }
+
+    void reserve(size_t cp) {
+        finish_migration();
+        if (cp <= capacity_) {
+            return;
+        }
+        T *block = traits::allocate(this->allocator(), cp);
+        size_t moved = 0;
+        try {
+            for (; moved != size_; ++moved) {
+                traits::construct(this->allocator(), block + moved, std::move_if_noexcept(data_[moved]));
+            }
+        } catch (...) {
+            for (size_t i = 0; i != moved; ++i) {
+                traits::destroy(this->allocator(), block + i);
+            }
+            traits::deallocate(this->allocator(), block, cp);
+            throw;
+        }
+        for (size_t i = 0; i != size_; ++i) {
+            traits::destroy(this->allocator(), data_ + i);
+        }
+        if (data_) {
+            traits::deallocate(this->allocator(), data_, capacity_);
+        }
+        data_ = block;
+        capacity_ = cp;
+    }
+
+    void swap(incremental_vector &other) noexcept {
+        using std::swap;
+        swap(this->allocator(), other.allocator());
+        std::swap(data_, other.data_);
+        std::swap(capacity_, other.capacity_);
+        std::swap(size_, other.size_);
+        std::swap(old_, other.old_);
+        std::swap(old_capacity_, other.old_capacity_);
+        std::swap(old_size_, other.old_size_);
+        std::swap(migrated_, other.migrated_);
+    }
+
+    friend void swap(incremental_vector &a, incremental_vector &b) noexcept {
+        a.swap(b);
+    }
+
+    friend bool operator==(incremental_vector const &a, incremental_vector const &b) {
+        return a.size_ == b.size_ && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(incremental_vector const &a, incremental_vector const &b) {
+        return !(a == b);
+    }
+
+private:
+    typedef std::allocator_traits<Allocator> traits;
+
+    // [migrated_, old_size_) still lives in old_, everything else in data_
+    T *slot(size_t index) noexcept {
+        return index - migrated_ < old_size_ - migrated_ ? old_ + index : data_ + index;
+    }
+
+    // A throwing move leaves the element it failed on in the old block
+    void migrate(size_t n) {
+        if (!old_) {
+            return;
+        }
+        for (size_t end = std::min(old_size_, migrated_ + n); migrated_ != end; ++migrated_) {
+            traits::construct(this->allocator(), data_ + migrated_, std::move_if_noexcept(old_[migrated_]));
+            traits::destroy(this->allocator(), old_ + migrated_);
+        }
+        if (migrated_ == old_size_) {
+            release_old();
+        }
+    }
+
+    void release_old() noexcept {
+        traits::deallocate(this->allocator(), old_, old_capacity_);
+        old_ = nullptr;
+        old_capacity_ = 0;
+        old_size_ = 0;
+        migrated_ = 0;
+    }
+
+    T *data_ = nullptr;
+    size_t capacity_ = 0;
+    size_t size_ = 0;
+    T *old_ = nullptr;
+    size_t old_capacity_ = 0;
+    size_t old_size_ = 0;
+    size_t migrated_ = 0;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+// Random-access iterator that is an index into a container with O(1) operator[],
+// for containers whose elements are not one contiguous array. Owner is const for
+// const iterators.
+template<typename Owner>
+struct index_iterator {
+    typedef std::random_access_iterator_tag iterator_category;
+    typedef typename std::remove_const_t<Owner>::value_type value_type;
+    typedef ptrdiff_t difference_type;
+    typedef decltype(std::declval<Owner &>()[0]) reference;
+    typedef std::remove_reference_t<reference> *pointer;
+
+    index_iterator() noexcept = default;
+
+    index_iterator(Owner *owner, size_t index) noexcept : owner_(owner), index_(index) {}
+
+    template<typename Other, typename = std::enable_if_t<std::is_const_v<Owner> && std::is_same_v<Other const, Owner>>>
+    index_iterator(index_iterator<Other> const &other) noexcept : owner_(other.owner()), index_(other.index()) {}
+
+    Owner *owner() const noexcept {
+        return owner_;
+    }
+
+    size_t index() const noexcept {
+        return index_;
+    }
+
+    reference operator*() const noexcept {
+        return (*owner_)[index_];
+    }
+
+    pointer operator->() const noexcept {
+        return &(*owner_)[index_];
+    }
+
+    reference operator[](ptrdiff_t n) const noexcept {
+        return (*owner_)[index_ + n];
+    }
+
+    index_iterator &operator++() noexcept {
+        ++index_;
+        return *this;
+    }
+
+    index_iterator operator++(int) noexcept {
+        index_iterator old = *this;
+        ++index_;
+        return old;
+    }
+
+    index_iterator &operator--() noexcept {
+        --index_;
+        return *this;
+    }
+
+    index_iterator operator--(int) noexcept {
+        index_iterator old = *this;
+        --index_;
+        return old;
+    }
+
+    index_iterator &operator+=(ptrdiff_t n) noexcept {
+        index_ += n;
+        return *this;
+    }
+
+    index_iterator &operator-=(ptrdiff_t n) noexcept {
+        index_ -= n;
+        return *this;
+    }
+
+    friend index_iterator operator+(index_iterator it, ptrdiff_t n) noexcept {
+        return it += n;
+    }
+
+    friend index_iterator operator+(ptrdiff_t n, index_iterator it) noexcept {
+        return it += n;
+    }
+
+    friend index_iterator operator-(index_iterator it, ptrdiff_t n) noexcept {
+        return it -= n;
+    }
+
+    friend ptrdiff_t operator-(index_iterator const &a, index_iterator const &b) noexcept {
+        return (ptrdiff_t) (a.index_ - b.index_);
+    }
+
+    friend bool operator==(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ == b.index_;
+    }
+
+    friend bool operator!=(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ != b.index_;
+    }
+
+    friend bool operator<(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ < b.index_;
+    }
+
+    friend bool operator>(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ > b.index_;
+    }
+
+    friend bool operator<=(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ <= b.index_;
+    }
+
+    friend bool operator>=(index_iterator const &a, index_iterator const &b) noexcept {
+        return a.index_ >= b.index_;
+    }
+
+private:
+    Owner *owner_ = nullptr;
+    size_t index_ = 0;
+};
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+enum : unsigned {
+    // Try explicit huge pages (MAP_HUGETLB) first; without a reserved pool this falls back to
+    // transparent huge pages
+    large_block_hugetlb = 1,
+    // Fault all pages in when mapping, so first touch does not pay for them
+    large_block_populate = 2,
+};
+
+// Allocator for big buffers: blocks of at least Threshold bytes are mmap'd on their own,
+// advised for transparent huge pages, and resized with mremap, so that vector growth of
+// trivially relocatable elements moves page tables instead of bytes. Smaller blocks use malloc.
+template<typename T, size_t Threshold = (size_t(2) << 20), unsigned Flags = 0>
+struct large_block_allocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "malloc cannot align T");
+
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef large_block_allocator<U, Threshold, Flags> other;
+    };
+
+    struct allocation_result {
+        T *ptr;
+        size_t count;
+    };
+
+    static constexpr size_t huge_page_size = size_t(2) << 20;
+
+    large_block_allocator() noexcept = default;
+
+    template<typename U>
+    large_block_allocator(large_block_allocator<U, Threshold, Flags> const &) noexcept {}
+
+    T *allocate(size_t n) {
+        return allocate_at_least(n).ptr;
+    }
+
+    // Large blocks report the whole mapping, so capacity grows to the page boundary
+    allocation_result allocate_at_least(size_t n) {
+        if (n > SIZE_MAX / sizeof(T) - huge_page_size) {
+            throw std::bad_alloc();
+        }
+        size_t bytes = n * sizeof(T);
+        if (!is_large(bytes)) {
+            void *ptr = std::malloc(bytes);
+            if (!ptr) {
+                throw std::bad_alloc();
+            }
+            return {static_cast<T *>(ptr), n};
+        }
+        size_t len = mapping_size(bytes);
+        return {static_cast<T *>(map_large(len)), len / sizeof(T)};
+    }
+
+    // Keeps the first min(old_n, new_n) objects' bytes; the block may move
+    T *reallocate(T *ptr, size_t old_n, size_t new_n) {
+        if (new_n > SIZE_MAX / sizeof(T) - huge_page_size) {
+            throw std::bad_alloc();
+        }
+        size_t old_bytes = old_n * sizeof(T);
+        size_t new_bytes = new_n * sizeof(T);
+        if (!is_large(old_bytes) && !is_large(new_bytes)) {
+            void *result = std::realloc(ptr, new_bytes);
+            if (!result) {
+                throw std::bad_alloc();
+            }
+            return static_cast<T *>(result);
+        }
+#ifdef __linux__
+        if (is_large(old_bytes) && is_large(new_bytes)) {
+            size_t old_len = mapping_size(old_bytes);
+            size_t new_len = mapping_size(new_bytes);
+            if (old_len == new_len) {
+                return ptr;
+            }
+            void *result = ::mremap(ptr, old_len, new_len, MREMAP_MAYMOVE);
+            if (result != MAP_FAILED) {
+                if (new_len > old_len) {
+                    advise(static_cast<char *>(result), new_len);
+                    prefault(static_cast<char *>(result) + old_len, new_len - old_len);
+                }
+                return static_cast<T *>(result);
+            }
+            // hugetlb mappings may refuse mremap on older kernels
+        }
+#endif
+        T *result = allocate(new_n);
+        std::memcpy(static_cast<void *>(result), static_cast<void const *>(ptr), std::min(old_bytes, new_bytes));
+        deallocate(ptr, old_n);
+        return result;
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        size_t bytes = n * sizeof(T);
+        if (is_large(bytes)) {
+            ::munmap(ptr, mapping_size(bytes));
+        } else {
+            std::free(ptr);
+        }
+    }
+
+    template<typename U>
+    friend bool operator==(large_block_allocator const &, large_block_allocator<U, Threshold, Flags> const &) noexcept {
+        return true;
+    }
+
+    template<typename U>
+    friend bool operator!=(large_block_allocator const &, large_block_allocator<U, Threshold, Flags> const &) noexcept {
+        return false;
+    }
+
+private:
+    static bool is_large(size_t bytes) noexcept {
+        return bytes >= Threshold;
+    }
+
+    // Explicit huge pages need whole huge pages; otherwise small mappings round to base pages
+    static size_t mapping_size(size_t bytes) noexcept {
+        size_t unit = (Flags & large_block_hugetlb) || bytes >= huge_page_size ? huge_page_size
+                                                                               : (size_t) ::sysconf(_SC_PAGESIZE);
+        return (bytes + unit - 1) / unit * unit;
+    }
+
+    static void *map_large(size_t len) {
+        int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+        if (Flags & large_block_hugetlb) {
+            void *ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                               flags | MAP_HUGETLB | ((Flags & large_block_populate) ? MAP_POPULATE : 0), -1, 0);
+            if (ptr != MAP_FAILED) {
+                return ptr;
+            }
+        }
+#endif
+        void *ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        advise(static_cast<char *>(ptr), len);
+        prefault(static_cast<char *>(ptr), len);
+        return ptr;
+    }
+
+    static void advise(char *ptr, size_t len) noexcept {
+#ifdef MADV_HUGEPAGE
+        // only a hint: fails harmlessly where THP is off or the mapping is hugetlb already
+        (void) ::madvise(ptr, len, MADV_HUGEPAGE);
+#endif
+    }
+
+    // After advise(), so that the faults can be served with huge pages
+    static void prefault(char *ptr, size_t len) noexcept {
+        if (!(Flags & large_block_populate)) {
+            return;
+        }
+#ifdef MADV_POPULATE_WRITE
+        if (::madvise(ptr, len, MADV_POPULATE_WRITE) == 0) {
+            return;
+        }
+#endif
+        size_t page = (size_t) ::sysconf(_SC_PAGESIZE);
+        for (size_t offset = 0; offset < len; offset += page) {
+            ptr[offset] = 0;
+        }
+    }
+};
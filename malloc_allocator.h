@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// malloc-backed allocator that reports the usable size of each block, so
+// vector can round its capacity up to the malloc size class it really got.
+template<typename T>
+struct malloc_allocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "malloc cannot align T");
+
+    typedef T value_type;
+
+    struct allocation_result {
+        T *ptr;
+        size_t count;
+    };
+
+    malloc_allocator() noexcept = default;
+
+    template<typename U>
+    malloc_allocator(malloc_allocator<U> const &) noexcept {}
+
+    T *allocate(size_t n) {
+        return allocate_at_least(n).ptr;
+    }
+
+    allocation_result allocate_at_least(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void *ptr = std::malloc(n * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+#ifdef __GLIBC__
+        return {static_cast<T *>(ptr), malloc_usable_size(ptr) / sizeof(T)};
+#else
+        return {static_cast<T *>(ptr), n};
+#endif
+    }
+
+    void deallocate(T *ptr, size_t) noexcept {
+        std::free(ptr);
+    }
+
+    template<typename U>
+    friend bool operator==(malloc_allocator const &, malloc_allocator<U> const &) noexcept {
+        return true;
+    }
+
+    template<typename U>
+    friend bool operator!=(malloc_allocator const &, malloc_allocator<U> const &) noexcept {
+        return false;
+    }
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A file that holds one vector's storage block, header included, mapped MAP_SHARED.
+// Growing extends the file and remaps it; reopening maps the old contents back.
+// It must outlive the vector it backs.
+struct mapped_file {
+    explicit mapped_file(char const *path) : fd_(::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) {
+        if (fd_ < 0) {
+            throw std::system_error(errno, std::generic_category(), path);
+        }
+    }
+
+    mapped_file(mapped_file const &) = delete;
+
+    mapped_file &operator=(mapped_file const &) = delete;
+
+    ~mapped_file() {
+        if (base_) {
+            ::munmap(base_, bytes_);
+        }
+        ::close(fd_);
+    }
+
+    size_t file_size() const {
+        struct stat st;
+        if (::fstat(fd_, &st) != 0) {
+            throw std::system_error(errno, std::generic_category(), "fstat");
+        }
+        return (size_t) st.st_size;
+    }
+
+    // Sizes the file to exactly bytes and maps it; only one block may be mapped at a time
+    void *map(size_t bytes) {
+        if (base_) {
+            throw std::logic_error("mapped_file already backs a vector");
+        }
+        if (::ftruncate(fd_, (off_t) bytes) != 0) {
+            throw std::bad_alloc();
+        }
+        return map_whole(bytes);
+    }
+
+    // Maps what an earlier owner left in the file, nullptr if it is empty
+    void *map_existing(size_t &bytes) {
+        if (base_) {
+            throw std::logic_error("mapped_file already backs a vector");
+        }
+        bytes = file_size();
+        return bytes ? map_whole(bytes) : nullptr;
+    }
+
+    // Resizes the mapped block in place when the kernel can, keeping its contents
+    void *remap(void *ptr, size_t old_bytes, size_t new_bytes) {
+        if (new_bytes > old_bytes && ::ftruncate(fd_, (off_t) new_bytes) != 0) {
+            throw std::bad_alloc();
+        }
+#ifdef __linux__
+        void *result = ::mremap(ptr, old_bytes, new_bytes, MREMAP_MAYMOVE);
+        if (result == MAP_FAILED) {
+            if (new_bytes > old_bytes) {
+                (void) ::ftruncate(fd_, (off_t) old_bytes);
+            }
+            throw std::bad_alloc();
+        }
+#else
+        // the file keeps the contents, so a fresh mapping sees them too
+        void *result = ::mmap(nullptr, new_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (result == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        ::munmap(ptr, old_bytes);
+#endif
+        if (new_bytes < old_bytes) {
+            (void) ::ftruncate(fd_, (off_t) new_bytes);
+        }
+        base_ = result;
+        bytes_ = new_bytes;
+        return result;
+    }
+
+    // The file keeps the block's contents for the next map_existing()
+    void unmap(void *ptr, size_t bytes) noexcept {
+        ::munmap(ptr, bytes);
+        base_ = nullptr;
+        bytes_ = 0;
+    }
+
+    // Writes dirty pages back before returning
+    void sync() {
+        if (base_ && ::msync(base_, bytes_, MS_SYNC) != 0) {
+            throw std::system_error(errno, std::generic_category(), "msync");
+        }
+    }
+
+private:
+    void *map_whole(size_t bytes) {
+        void *ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        base_ = ptr;
+        bytes_ = bytes;
+        return ptr;
+    }
+
+    int fd_;
+    void *base_ = nullptr;
+    size_t bytes_ = 0;
+};
+
+// Allocator that places vector storage in a mapped_file. Use it with vector's
+// adopt_storage constructor to pick up what the file already holds. Copies of the
+// vector go to malloc'd memory (the file holds a single block), as does a
+// default-constructed allocator. T must be trivially relocatable.
+template<typename T>
+struct mapped_file_allocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "malloc cannot align T");
+
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    struct allocation_result {
+        T *ptr;
+        size_t count;
+    };
+
+    mapped_file_allocator() noexcept = default;
+
+    mapped_file_allocator(mapped_file &file) noexcept : file_(&file) {}
+
+    template<typename U>
+    mapped_file_allocator(mapped_file_allocator<U> const &other) noexcept : file_(other.get_file()) {}
+
+    mapped_file *get_file() const noexcept {
+        return file_;
+    }
+
+    mapped_file_allocator select_on_container_copy_construction() const noexcept {
+        return mapped_file_allocator();
+    }
+
+    T *allocate(size_t n) {
+        if (n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void *ptr = file_ ? file_->map(n * sizeof(T)) : std::malloc(n * sizeof(T));
+        if (!ptr) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(ptr);
+    }
+
+    // Keeps the first min(old_n, new_n) objects' bytes; the block may move
+    T *reallocate(T *ptr, size_t old_n, size_t new_n) {
+        if (new_n > SIZE_MAX / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void *result = file_ ? file_->remap(ptr, old_n * sizeof(T), new_n * sizeof(T))
+                             : std::realloc(ptr, new_n * sizeof(T));
+        if (!result) {
+            throw std::bad_alloc();
+        }
+        return static_cast<T *>(result);
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        if (file_) {
+            file_->unmap(ptr, n * sizeof(T));
+        } else {
+            std::free(ptr);
+        }
+    }
+
+    // The block an earlier owner left in the file, {nullptr, 0} if there is none
+    allocation_result adopt() {
+        if (!file_) {
+            return {nullptr, 0};
+        }
+        size_t bytes;
+        T *ptr = static_cast<T *>(file_->map_existing(bytes));
+        return {ptr, bytes / sizeof(T)};
+    }
+
+    template<typename U>
+    friend bool operator==(mapped_file_allocator const &a, mapped_file_allocator<U> const &b) noexcept {
+        return a.get_file() == b.get_file();
+    }
+
+    template<typename U>
+    friend bool operator!=(mapped_file_allocator const &a, mapped_file_allocator<U> const &b) noexcept {
+        return a.get_file() != b.get_file();
+    }
+
+private:
+    mapped_file *file_ = nullptr;
+};
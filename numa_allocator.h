@@ -0,0 +1,257 @@
+#pragma once
+
+#include "vector.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
+enum numa_mode : unsigned {
+    // Pages are placed by whichever thread writes them first. Build the vector with
+    // parallel_resize or parallel_construct, or with reserve_and_write called from
+    // the workers themselves, and each worker's slice lands on its own node.
+    numa_first_touch = 0,
+    // Pages round-robin over all nodes the process may use
+    numa_interleave = 1,
+    // Pages only come from one node
+    numa_bind = 2,
+};
+
+namespace numa_detail {
+    constexpr size_t max_nodes = 1024;
+    constexpr size_t mask_words = max_nodes / (sizeof(unsigned long) * 8);
+
+    struct node_mask {
+        unsigned long bits[mask_words] = {};
+    };
+
+#ifdef __linux__
+    // The nodes this process may allocate on; node 0 alone where the kernel has no NUMA support
+    inline node_mask const &allowed_nodes() noexcept {
+        static node_mask const result = [] {
+            node_mask mask;
+            int mode;
+            if (::syscall(SYS_get_mempolicy, &mode, mask.bits, max_nodes, nullptr, MPOL_F_MEMS_ALLOWED) != 0) {
+                mask = node_mask();
+                mask.bits[0] = 1;
+            }
+            return mask;
+        }();
+        return result;
+    }
+
+    // Where the kernel has no NUMA support, or the sandbox forbids mbind, pages are
+    // left to first touch: placement is a performance hint, not a guarantee
+    inline void place(void *ptr, size_t len, numa_mode mode, int node) {
+        if (mode == numa_first_touch) {
+            return;
+        }
+        node_mask mask;
+        int policy;
+        if (mode == numa_interleave) {
+            mask = allowed_nodes();
+            policy = MPOL_INTERLEAVE;
+        } else {
+            if (node < 0 || (size_t) node >= max_nodes) {
+                throw std::system_error(EINVAL, std::generic_category(), "mbind");
+            }
+            mask.bits[node / (sizeof(unsigned long) * 8)] = 1ul << (node % (sizeof(unsigned long) * 8));
+            policy = MPOL_BIND;
+        }
+        if (::syscall(SYS_mbind, ptr, len, policy, mask.bits, max_nodes, 0) != 0 && errno != ENOSYS &&
+            errno != EPERM) {
+            throw std::system_error(errno, std::generic_category(), "mbind");
+        }
+    }
+#else
+    inline void place(void *, size_t, numa_mode, int) {}
+#endif
+}
+
+// Number of NUMA nodes the process may allocate on (1 without NUMA support)
+inline size_t numa_node_count() noexcept {
+#ifdef __linux__
+    size_t n = 0;
+    for (unsigned long word : numa_detail::allowed_nodes().bits) {
+        n += (size_t) __builtin_popcountl(word);
+    }
+    return n;
+#else
+    return 1;
+#endif
+}
+
+// Allocator that places big vector storage on NUMA nodes by a numa_mode. Blocks of
+// at least Threshold bytes are mmap'd on their own and bound with mbind before any
+// page is touched; smaller blocks come from malloc and follow the default policy.
+// Linux only: elsewhere every mode behaves as first touch.
+template<typename T, size_t Threshold = (size_t(2) << 20)>
+struct numa_allocator {
+    static_assert(alignof(T) <= alignof(std::max_align_t), "malloc cannot align T");
+
+    typedef T value_type;
+    typedef std::false_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    template<typename U>
+    struct rebind {
+        typedef numa_allocator<U, Threshold> other;
+    };
+
+    struct allocation_result {
+        T *ptr;
+        size_t count;
+    };
+
+    numa_allocator() noexcept = default;
+
+    // node only matters for numa_bind
+    explicit numa_allocator(numa_mode mode, int node = 0) noexcept : mode_(mode), node_(node) {}
+
+    template<typename U>
+    numa_allocator(numa_allocator<U, Threshold> const &other) noexcept : mode_(other.mode()), node_(other.node()) {}
+
+    numa_mode mode() const noexcept {
+        return mode_;
+    }
+
+    int node() const noexcept {
+        return node_;
+    }
+
+    T *allocate(size_t n) {
+        return allocate_at_least(n).ptr;
+    }
+
+    // Large blocks report the whole mapping, so capacity grows to the page boundary
+    allocation_result allocate_at_least(size_t n) {
+        size_t page = page_size();
+        if (n > (SIZE_MAX - page) / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        size_t bytes = n * sizeof(T);
+        if (bytes < Threshold) {
+            void *ptr = std::malloc(bytes);
+            if (!ptr) {
+                throw std::bad_alloc();
+            }
+            return {static_cast<T *>(ptr), n};
+        }
+        size_t len = (bytes + page - 1) / page * page;
+        void *ptr = ::mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw std::bad_alloc();
+        }
+        try {
+            numa_detail::place(ptr, len, mode_, node_);
+        } catch (...) {
+            ::munmap(ptr, len);
+            throw;
+        }
+        return {static_cast<T *>(ptr), len / sizeof(T)};
+    }
+
+    void deallocate(T *ptr, size_t n) noexcept {
+        size_t bytes = n * sizeof(T);
+        if (bytes < Threshold) {
+            std::free(ptr);
+        } else {
+            size_t page = page_size();
+            ::munmap(ptr, (bytes + page - 1) / page * page);
+        }
+    }
+
+    template<typename U>
+    friend bool operator==(numa_allocator const &a, numa_allocator<U, Threshold> const &b) noexcept {
+        return a.mode() == b.mode() && (a.mode() != numa_bind || a.node() == b.node());
+    }
+
+    template<typename U>
+    friend bool operator!=(numa_allocator const &a, numa_allocator<U, Threshold> const &b) noexcept {
+        return !(a == b);
+    }
+
+private:
+    static size_t page_size() noexcept {
+        return (size_t) ::sysconf(_SC_PAGESIZE);
+    }
+
+    numa_mode mode_ = numa_first_touch;
+    int node_ = 0;
+};
+
+// Elements [first, last) sit on node; -1 for pages not faulted in yet, or where the
+// kernel cannot tell
+struct numa_range {
+    size_t first;
+    size_t last;
+    int node;
+};
+
+// Which node holds each run of elements, in order, so a scheduler can send work
+// on a range to threads on the same node. An element counts toward the page its
+// first byte is on. Costs one move_pages query per 512 pages.
+template<typename T>
+vector<numa_range> numa_ranges(span<T const> elems) {
+    vector<numa_range> result;
+    if (elems.empty()) {
+        return result;
+    }
+    size_t bytes = elems.size() * sizeof(T);
+    uintptr_t begin = (uintptr_t) elems.data();
+    size_t page = (size_t) ::sysconf(_SC_PAGESIZE);
+    uintptr_t first_page = begin / page * page;
+    size_t pages = (begin + bytes - first_page + page - 1) / page;
+    // index of the first element that starts at or after address
+    auto element_at = [&](uintptr_t address) {
+        return address <= begin ? size_t(0) : std::min(elems.size(), (size_t) ((address - begin + sizeof(T) - 1) / sizeof(T)));
+    };
+    constexpr size_t batch = 512;
+    void *addresses[batch];
+    int status[batch];
+    for (size_t done = 0; done < pages; done += batch) {
+        size_t count = std::min(batch, pages - done);
+        for (size_t i = 0; i != count; ++i) {
+            addresses[i] = (void *) (first_page + (done + i) * page);
+            status[i] = -1;
+        }
+#ifdef __linux__
+        if (::syscall(SYS_move_pages, 0, count, addresses, nullptr, status, 0) != 0) {
+            std::fill_n(status, count, -1);
+        }
+#endif
+        for (size_t i = 0; i != count; ++i) {
+            int node = status[i] < 0 ? -1 : status[i];
+            size_t first = element_at((uintptr_t) addresses[i]);
+            size_t last = element_at((uintptr_t) addresses[i] + page);
+            if (first == last) {
+                continue;
+            }
+            if (!result.empty() && std::as_const(result).back().node == node) {
+                result.back().last = last;
+            } else {
+                result.push_back(numa_range{first, last, node});
+            }
+        }
+    }
+    return result;
+}
+
+template<typename Vector, typename = decltype(std::declval<Vector const &>().const_span())>
+vector<numa_range> numa_ranges(Vector const &v) {
+    return numa_ranges(v.const_span());
+}
@@ -0,0 +1,355 @@
+#pragma once
+
+#include "index_iterator.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+// Block codec behind packed_vector. A block holds 128 values as offsets from
+// the block minimum (frame of reference), each stored in the width of the
+// largest offset. Values are dealt round-robin to the lanes of a 16-byte
+// register, and each lane keeps its own bit stream, so word w of lane l sits
+// at words[w * lanes + l]: one SIMD load brings in the same word of every
+// lane, and decoding runs the same shifts on all of them at once.
+namespace packed_codec {
+    constexpr size_t block_size = 128;
+
+    template<typename T>
+    constexpr unsigned word_bits = sizeof(T) * 8;
+
+    template<typename T>
+    constexpr size_t lanes = 16 / sizeof(T);
+
+    template<typename T>
+    constexpr T low_mask(unsigned bits) noexcept {
+        return bits == word_bits<T> ? ~T(0) : (T(1) << bits) - 1;
+    }
+
+    // A block of b-bit values takes b words per lane
+    template<typename T>
+    constexpr size_t block_words(unsigned bits) noexcept {
+        return bits * lanes<T>;
+    }
+
+    template<typename T>
+    unsigned width(T span) noexcept {
+        if (span == 0) {
+            return 0;
+        }
+        if constexpr (sizeof(T) == 8) {
+            return 64 - __builtin_clzll(span);
+        } else {
+            return 32 - __builtin_clz(span);
+        }
+    }
+
+    // words must hold block_words(bits) zeros
+    template<typename T>
+    void encode(T const *values, T base, unsigned bits, T *words) noexcept {
+        if (bits == 0) {
+            return;
+        }
+        for (size_t j = 0; j != block_size; ++j) {
+            T delta = values[j] - base;
+            size_t lane = j % lanes<T>;
+            size_t bit = (j / lanes<T>) * bits;
+            size_t w = bit / word_bits<T>;
+            unsigned shift = bit % word_bits<T>;
+            words[w * lanes<T> + lane] |= delta << shift;
+            if (shift + bits > word_bits<T>) {
+                words[(w + 1) * lanes<T> + lane] |= delta >> (word_bits<T> - shift);
+            }
+        }
+    }
+
+    template<typename T>
+    T get(T const *words, T base, unsigned bits, size_t j) noexcept {
+        if (bits == 0) {
+            return base;
+        }
+        size_t lane = j % lanes<T>;
+        size_t bit = (j / lanes<T>) * bits;
+        size_t w = bit / word_bits<T>;
+        unsigned shift = bit % word_bits<T>;
+        T v = words[w * lanes<T> + lane] >> shift;
+        if (shift + bits > word_bits<T>) {
+            v |= words[(w + 1) * lanes<T> + lane] << (word_bits<T> - shift);
+        }
+        return base + (v & low_mask<T>(bits));
+    }
+
+    template<typename T>
+    void decode_scalar(T const *words, T base, unsigned bits, T *out) noexcept {
+        for (size_t j = 0; j != block_size; ++j) {
+            out[j] = get(words, base, bits, j);
+        }
+    }
+
+#if VECTOR_SIMD_X86
+    // Walks the lane streams together; the word that follows is only loaded
+    // when a value straddles two words, so nothing past the block is read
+    template<typename T>
+    void decode_sse2(T const *words, T base, unsigned bits, T *out) noexcept {
+        constexpr bool wide = sizeof(T) == 8;
+        __m128i mask = wide ? _mm_set1_epi64x((long long) low_mask<T>(bits)) : _mm_set1_epi32((int) low_mask<T>(bits));
+        __m128i bias = wide ? _mm_set1_epi64x((long long) base) : _mm_set1_epi32((int) base);
+        __m128i const *src = reinterpret_cast<__m128i const *>(words);
+        __m128i *dst = reinterpret_cast<__m128i *>(out);
+        size_t w = 0;
+        unsigned shift = 0;
+        for (size_t pos = 0; pos != block_size / lanes<T>; ++pos) {
+            __m128i v = _mm_loadu_si128(src + w);
+            __m128i count = _mm_cvtsi32_si128((int) shift);
+            v = wide ? _mm_srl_epi64(v, count) : _mm_srl_epi32(v, count);
+            if (shift + bits > word_bits<T>) {
+                __m128i next = _mm_loadu_si128(src + w + 1);
+                __m128i back = _mm_cvtsi32_si128((int) (word_bits<T> - shift));
+                v = _mm_or_si128(v, wide ? _mm_sll_epi64(next, back) : _mm_sll_epi32(next, back));
+            }
+            v = _mm_and_si128(v, mask);
+            _mm_storeu_si128(dst + pos, wide ? _mm_add_epi64(v, bias) : _mm_add_epi32(v, bias));
+            shift += bits;
+            if (shift >= word_bits<T>) {
+                shift -= word_bits<T>;
+                ++w;
+            }
+        }
+    }
+#elif VECTOR_SIMD_NEON
+    // Same walk as the scalar lanes; NEON shifts right by a negative left shift
+    template<typename T>
+    void decode_neon(T const *words, T base, unsigned bits, T *out) noexcept {
+        size_t w = 0;
+        unsigned shift = 0;
+        for (size_t pos = 0; pos != block_size / lanes<T>; ++pos) {
+            T const *cur = words + w * lanes<T>;
+            bool straddles = shift + bits > word_bits<T>;
+            if constexpr (sizeof(T) == 8) {
+                uint64x2_t v = vshlq_u64(vld1q_u64(cur), vdupq_n_s64(-(int64_t) shift));
+                if (straddles) {
+                    v = vorrq_u64(v, vshlq_u64(vld1q_u64(cur + lanes<T>), vdupq_n_s64((int64_t) (word_bits<T> - shift))));
+                }
+                v = vandq_u64(v, vdupq_n_u64(low_mask<T>(bits)));
+                vst1q_u64(out + pos * lanes<T>, vaddq_u64(v, vdupq_n_u64(base)));
+            } else {
+                uint32x4_t v = vshlq_u32(vld1q_u32(cur), vdupq_n_s32(-(int32_t) shift));
+                if (straddles) {
+                    v = vorrq_u32(v, vshlq_u32(vld1q_u32(cur + lanes<T>), vdupq_n_s32((int32_t) (word_bits<T> - shift))));
+                }
+                v = vandq_u32(v, vdupq_n_u32(low_mask<T>(bits)));
+                vst1q_u32(out + pos * lanes<T>, vaddq_u32(v, vdupq_n_u32(base)));
+            }
+            shift += bits;
+            if (shift >= word_bits<T>) {
+                shift -= word_bits<T>;
+                ++w;
+            }
+        }
+    }
+#endif
+
+    // Writes all block_size values of the block to out
+    template<typename T>
+    void decode(T const *words, T base, unsigned bits, T *out) noexcept {
+        if (bits == 0) {
+            std::fill_n(out, block_size, base);
+            return;
+        }
+#if VECTOR_SIMD_X86
+        decode_sse2(words, base, bits, out);
+#elif VECTOR_SIMD_NEON
+        decode_neon(words, base, bits, out);
+#else
+        decode_scalar(words, base, bits, out);
+#endif
+    }
+}
+
+// Read-only vector of unsigned 32- or 64-bit integers, bit-packed in blocks of
+// 128 by packed_codec. Sorted IDs and small counters shrink to a few bits per
+// value. operator[] unpacks one value in O(1); decompress_into() and
+// for_each_block() unpack whole blocks with SIMD. The packed words live in
+// ordinary vectors, so copies share them through the same reference count.
+template<typename T, typename RefCount = plain_ref_count>
+struct packed_vector {
+    static_assert(std::is_unsigned_v<T> && (sizeof(T) == 4 || sizeof(T) == 8),
+                  "packed_vector holds 32- or 64-bit unsigned integers");
+
+    typedef T value_type;
+    typedef index_iterator<packed_vector const> iterator;
+    typedef index_iterator<packed_vector const> const_iterator;
+
+    packed_vector() = default;
+
+    explicit packed_vector(span<T const> values) {
+        pack(values.data(), values.size());
+    }
+
+    template<typename Vector, typename = decltype(std::declval<Vector const &>().const_span())>
+    explicit packed_vector(Vector const &values) : packed_vector(values.const_span()) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    packed_vector(InputIterator beg, InputIterator en) {
+        vector<T> values(beg, en);
+        pack(values.const_span().data(), values.size());
+    }
+
+    packed_vector(std::initializer_list<T> init) : packed_vector(span<T const>(init.begin(), init.size())) {}
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    // Bytes taken by the packed words and the block headers
+    size_t packed_bytes() const noexcept {
+        return words_.size() * sizeof(T) + blocks_.size() * sizeof(block);
+    }
+
+    T operator[](size_t index) const noexcept {
+        block const &b = blocks_.unchecked_at(index / packed_codec::block_size);
+        return packed_codec::get(words_.data() + b.offset, b.base, b.bits, index % packed_codec::block_size);
+    }
+
+    T checked_at(size_t index) const {
+        if (index >= size_) {
+            throw std::runtime_error("packed_vector index out of range");
+        }
+        return (*this)[index];
+    }
+
+    T front() const noexcept {
+        return (*this)[0];
+    }
+
+    T back() const noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const noexcept {
+        return const_iterator(this, size_);
+    }
+
+    // Calls f(values, n) with each block unpacked, in order
+    template<typename F>
+    void for_each_block(F f) const {
+        T buffer[packed_codec::block_size];
+        for (size_t k = 0; k != blocks_.size(); ++k) {
+            unpack_block(k, buffer);
+            f(static_cast<T const *>(buffer), std::min(packed_codec::block_size, size_ - k * packed_codec::block_size));
+        }
+    }
+
+    // Replaces the contents of out with the unpacked values
+    template<typename Vector>
+    void decompress_into(Vector &out) const {
+        out.clear();
+        out.reserve(size_);
+        out.reserve_and_write(size_, [this](T *dst, size_t) {
+            size_t full = size_ / packed_codec::block_size;
+            for (size_t k = 0; k != full; ++k) {
+                unpack_block(k, dst + k * packed_codec::block_size);
+            }
+            if (full != blocks_.size()) {
+                T buffer[packed_codec::block_size];
+                unpack_block(full, buffer);
+                std::memcpy(dst + full * packed_codec::block_size, buffer, (size_ - full * packed_codec::block_size) * sizeof(T));
+            }
+            return size_;
+        });
+    }
+
+    template<typename Vector = vector<T>>
+    Vector decompress() const {
+        Vector result;
+        decompress_into(result);
+        return result;
+    }
+
+    void swap(packed_vector &other) {
+        using std::swap;
+        swap(words_, other.words_);
+        swap(blocks_, other.blocks_);
+        swap(size_, other.size_);
+    }
+
+    friend void swap(packed_vector &a, packed_vector &b) {
+        a.swap(b);
+    }
+
+    // The encoding is a function of the values, so equal contents pack alike
+    friend bool operator==(packed_vector const &a, packed_vector const &b) {
+        return a.size_ == b.size_ && a.blocks_ == b.blocks_ && a.words_ == b.words_;
+    }
+
+    friend bool operator!=(packed_vector const &a, packed_vector const &b) {
+        return !(a == b);
+    }
+
+private:
+    struct block {
+        T base;
+        unsigned bits;
+        size_t offset;
+
+        friend bool operator==(block const &a, block const &b) noexcept {
+            return a.base == b.base && a.bits == b.bits && a.offset == b.offset;
+        }
+    };
+
+    void unpack_block(size_t k, T *out) const noexcept {
+        block const &b = blocks_.unchecked_at(k);
+        packed_codec::decode(words_.data() + b.offset, b.base, b.bits, out);
+    }
+
+    // The last block is padded with its minimum
+    void pack(T const *values, size_t n) {
+        size_t count = (n + packed_codec::block_size - 1) / packed_codec::block_size;
+        vector<block, 1, RefCount> blocks;
+        blocks.reserve(count);
+        size_t total = 0;
+        for (size_t k = 0; k != count; ++k) {
+            T const *first = values + k * packed_codec::block_size;
+            T const *last = values + std::min(n, (k + 1) * packed_codec::block_size);
+            auto [lo, hi] = std::minmax_element(first, last);
+            unsigned bits = packed_codec::width<T>(*hi - *lo);
+            blocks.push_back(block{*lo, bits, total});
+            total += packed_codec::block_words<T>(bits);
+        }
+        vector<T, 1, RefCount> words(total, T(0));
+        span<T> out = words.mutable_span();
+        T padded[packed_codec::block_size];
+        for (size_t k = 0; k != count; ++k) {
+            block const &b = blocks.unchecked_at(k);
+            T const *first = values + k * packed_codec::block_size;
+            size_t m = std::min(packed_codec::block_size, n - k * packed_codec::block_size);
+            if (m != packed_codec::block_size) {
+                std::copy(first, first + m, padded);
+                std::fill(padded + m, padded + packed_codec::block_size, b.base);
+                first = padded;
+            }
+            packed_codec::encode(first, b.base, b.bits, out.data() + b.offset);
+        }
+        words_ = std::move(words);
+        blocks_ = std::move(blocks);
+        size_ = n;
+    }
+
+    vector<T, 1, RefCount> words_;
+    vector<block, 1, RefCount> blocks_;
+    size_t size_ = 0;
+};
@@ -0,0 +1,523 @@
+#pragma once
+
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <utility>
+
+// Vector of T as a 32-way trie of leaves plus a tail leaf. Copies share the whole
+// tree in O(1); a write to a shared tree copies only the nodes on the path to one
+// leaf, and push_back/pop_back work on the tail. Nodes a vector owns alone are
+// changed in place, so after the first write to a path, further writes near it
+// cost no copies: a freshly copied vector edited in bulk behaves like a transient.
+template<typename T, typename RefCount = plain_ref_count>
+struct persistent_vector {
+    typedef T value_type;
+
+    static constexpr unsigned bits = 5;
+    static constexpr size_t width = size_t(1) << bits;
+    static constexpr size_t mask = width - 1;
+
+private:
+    struct node {
+        typename RefCount::counter ref_count;
+
+        node() noexcept : ref_count(1) {}
+    };
+
+    struct leaf : node {
+        size_t count = 0;
+        alignas(T) unsigned char buf[sizeof(T) * width];
+
+        T *data() noexcept {
+            return std::launder(reinterpret_cast<T *>(buf));
+        }
+
+        T const *data() const noexcept {
+            return std::launder(reinterpret_cast<T const *>(buf));
+        }
+    };
+
+    struct branch : node {
+        // leaves at the lowest branch level, branches above; unused slots are null
+        node *children[width] = {};
+    };
+
+    // the deepest possible trie: each level takes bits of the index
+    static constexpr unsigned max_depth = (sizeof(size_t) * 8 + bits - 1) / bits;
+
+public:
+    struct const_iterator {
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T const *pointer;
+        typedef T const &reference;
+
+        const_iterator() noexcept = default;
+
+        T const &operator*() const noexcept {
+            size_t base = index_ & ~mask;
+            if (!block_ || base != block_base_) {
+                block_ = owner_->leaf_for(index_)->data();
+                block_base_ = base;
+            }
+            return block_[index_ & mask];
+        }
+
+        T const *operator->() const noexcept {
+            return &**this;
+        }
+
+        T const &operator[](ptrdiff_t n) const noexcept {
+            return (*owner_)[index_ + n];
+        }
+
+        const_iterator &operator++() noexcept {
+            ++index_;
+            return *this;
+        }
+
+        const_iterator operator++(int) noexcept {
+            const_iterator old = *this;
+            ++index_;
+            return old;
+        }
+
+        const_iterator &operator--() noexcept {
+            --index_;
+            return *this;
+        }
+
+        const_iterator operator--(int) noexcept {
+            const_iterator old = *this;
+            --index_;
+            return old;
+        }
+
+        const_iterator &operator+=(ptrdiff_t n) noexcept {
+            index_ += n;
+            return *this;
+        }
+
+        const_iterator &operator-=(ptrdiff_t n) noexcept {
+            index_ -= n;
+            return *this;
+        }
+
+        friend const_iterator operator+(const_iterator it, ptrdiff_t n) noexcept {
+            return it += n;
+        }
+
+        friend const_iterator operator+(ptrdiff_t n, const_iterator it) noexcept {
+            return it += n;
+        }
+
+        friend const_iterator operator-(const_iterator it, ptrdiff_t n) noexcept {
+            return it -= n;
+        }
+
+        friend ptrdiff_t operator-(const_iterator const &a, const_iterator const &b) noexcept {
+            return (ptrdiff_t) (a.index_ - b.index_);
+        }
+
+        friend bool operator==(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+        friend bool operator!=(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ != b.index_;
+        }
+
+        friend bool operator<(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ < b.index_;
+        }
+
+        friend bool operator>(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ > b.index_;
+        }
+
+        friend bool operator<=(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ <= b.index_;
+        }
+
+        friend bool operator>=(const_iterator const &a, const_iterator const &b) noexcept {
+            return a.index_ >= b.index_;
+        }
+
+    private:
+        friend struct persistent_vector;
+
+        const_iterator(persistent_vector const *owner, size_t index) noexcept : owner_(owner), index_(index) {}
+
+        persistent_vector const *owner_ = nullptr;
+        size_t index_ = 0;
+        // the leaf holding index_ when it was last read, so that scans walk the tree once per leaf
+        mutable T const *block_ = nullptr;
+        mutable size_t block_base_ = 0;
+    };
+
+    typedef const_iterator iterator;
+
+    persistent_vector() noexcept = default;
+
+    persistent_vector(std::initializer_list<T> init) : persistent_vector(init.begin(), init.end()) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    persistent_vector(InputIterator beg, InputIterator en) {
+        for (; beg != en; ++beg) {
+            emplace_back(*beg);
+        }
+    }
+
+    persistent_vector(persistent_vector const &other) noexcept
+            : size_(other.size_), shift_(other.shift_), root_(other.root_), tail_(other.tail_) {
+        if (root_) {
+            RefCount::add(root_->ref_count);
+        }
+        if (tail_) {
+            RefCount::add(tail_->ref_count);
+        }
+    }
+
+    persistent_vector(persistent_vector &&other) noexcept
+            : size_(other.size_), shift_(other.shift_), root_(other.root_), tail_(other.tail_) {
+        other.size_ = 0;
+        other.shift_ = bits;
+        other.root_ = nullptr;
+        other.tail_ = nullptr;
+    }
+
+    persistent_vector &operator=(persistent_vector const &other) noexcept {
+        persistent_vector(other).swap(*this);
+        return *this;
+    }
+
+    persistent_vector &operator=(persistent_vector &&other) noexcept {
+        persistent_vector(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~persistent_vector() {
+        clear();
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    T const &operator[](size_t index) const noexcept {
+        return leaf_for(index)->data()[index & mask];
+    }
+
+    // Copies the nodes on the path to index that other vectors still share
+    T &operator[](size_t index) {
+        return mutable_leaf(index)->data()[index & mask];
+    }
+
+    T const &front() const noexcept {
+        return (*this)[0];
+    }
+
+    T const &back() const noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    // value may be an element of this vector
+    void set(size_t index, T const &value) {
+        T tmp(value);
+        (*this)[index] = std::move(tmp);
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const noexcept {
+        return const_iterator(this, size_);
+    }
+
+    void push_back(T const &value) {
+        emplace_back(value);
+    }
+
+    void push_back(T &&value) {
+        emplace_back(std::move(value));
+    }
+
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (tail_ && tail_->count < width) {
+            own(tail_);
+            T *slot = tail_->data() + tail_->count;
+            new(slot) T(std::forward<Args>(args)...);
+            ++tail_->count;
+            ++size_;
+            return *slot;
+        }
+        // built first: args may refer to our elements, and a full tail goes into the tree
+        std::unique_ptr<leaf> fresh(new leaf);
+        new(fresh->data()) T(std::forward<Args>(args)...);
+        fresh->count = 1;
+        if (tail_) {
+            try {
+                push_tail();
+            } catch (...) {
+                std::destroy_at(fresh->data());
+                throw;
+            }
+        }
+        tail_ = fresh.release();
+        ++size_;
+        return *tail_->data();
+    }
+
+    void pop_back() {
+        if (size_ == 0) {
+            throw std::runtime_error("attempt to pop_back in empty persistent_vector");
+        }
+        if (tail_->count > 1) {
+            own(tail_);
+            std::destroy_at(tail_->data() + tail_->count - 1);
+            --tail_->count;
+            --size_;
+            return;
+        }
+        if (size_ == 1) {
+            release(tail_, 0);
+            tail_ = nullptr;
+            size_ = 0;
+            return;
+        }
+        pop_tail();
+    }
+
+    void clear() noexcept {
+        if (root_) {
+            release(root_, shift_);
+        }
+        if (tail_) {
+            release(tail_, 0);
+        }
+        size_ = 0;
+        shift_ = bits;
+        root_ = nullptr;
+        tail_ = nullptr;
+    }
+
+    void swap(persistent_vector &other) noexcept {
+        std::swap(size_, other.size_);
+        std::swap(shift_, other.shift_);
+        std::swap(root_, other.root_);
+        std::swap(tail_, other.tail_);
+    }
+
+    friend void swap(persistent_vector &a, persistent_vector &b) noexcept {
+        a.swap(b);
+    }
+
+    // Leaves shared by both vectors compare equal without reading them
+    friend bool operator==(persistent_vector const &a, persistent_vector const &b) {
+        if (a.size_ != b.size_) {
+            return false;
+        }
+        for (size_t base = 0; base < a.size_; base += width) {
+            leaf const *la = a.leaf_for(base);
+            leaf const *lb = b.leaf_for(base);
+            size_t n = std::min(width, a.size_ - base);
+            if (la != lb && !std::equal(la->data(), la->data() + n, lb->data())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend bool operator!=(persistent_vector const &a, persistent_vector const &b) {
+        return !(a == b);
+    }
+
+private:
+    // The tree holds [0, tail_offset()), the tail the rest
+    size_t tail_offset() const noexcept {
+        return size_ < width ? 0 : ((size_ - 1) & ~mask);
+    }
+
+    leaf *leaf_for(size_t index) const noexcept {
+        if (index >= tail_offset()) {
+            return tail_;
+        }
+        node *n = root_;
+        for (unsigned level = shift_; level != 0; level -= bits) {
+            n = static_cast<branch *>(n)->children[(index >> level) & mask];
+        }
+        return static_cast<leaf *>(n);
+    }
+
+    static void release(node *n, unsigned level) noexcept {
+        if (!RefCount::release(n->ref_count)) {
+            return;
+        }
+        if (level == 0) {
+            leaf *l = static_cast<leaf *>(n);
+            std::destroy(l->data(), l->data() + l->count);
+            delete l;
+            return;
+        }
+        branch *b = static_cast<branch *>(n);
+        for (node *child : b->children) {
+            if (child) {
+                release(child, level - bits);
+            }
+        }
+        delete b;
+    }
+
+    // Makes slot point to a node only we hold, copying it if it is shared. The copy
+    // has the same contents, so a throw after some slots were replaced changes nothing.
+    static void own(leaf *&slot) {
+        if (RefCount::unique(slot->ref_count)) {
+            return;
+        }
+        std::unique_ptr<leaf> copy(new leaf);
+        std::uninitialized_copy(slot->data(), slot->data() + slot->count, copy->data());
+        copy->count = slot->count;
+        // the others may have let go meanwhile
+        release(slot, 0);
+        slot = copy.release();
+    }
+
+    static branch *own_branch(node *&slot, unsigned level) {
+        branch *b = static_cast<branch *>(slot);
+        if (RefCount::unique(b->ref_count)) {
+            return b;
+        }
+        branch *copy = new branch;
+        for (size_t i = 0; i != width; ++i) {
+            if ((copy->children[i] = b->children[i])) {
+                RefCount::add(copy->children[i]->ref_count);
+            }
+        }
+        release(b, level);
+        slot = copy;
+        return copy;
+    }
+
+    leaf *mutable_leaf(size_t index) {
+        if (index >= tail_offset()) {
+            own(tail_);
+            return tail_;
+        }
+        node **slot = &root_;
+        for (unsigned level = shift_; level != 0; level -= bits) {
+            slot = &own_branch(*slot, level)->children[(index >> level) & mask];
+        }
+        leaf *l = static_cast<leaf *>(*slot);
+        own(l);
+        *slot = l;
+        return l;
+    }
+
+    // A chain of levels / bits branches leading down to l; nothing leaks if an allocation throws
+    static node *new_path(unsigned level, leaf *l) {
+        std::unique_ptr<branch> chain[max_depth];
+        for (unsigned i = 0; i != level / bits; ++i) {
+            chain[i].reset(new branch);
+        }
+        node *top = l;
+        for (unsigned i = 0; i != level / bits; ++i) {
+            chain[i]->children[0] = top;
+            top = chain[i].release();
+        }
+        return top;
+    }
+
+    // Moves the full tail into the tree, at index size_ - width
+    void push_tail() {
+        size_t index = size_ - 1;
+        if (!root_) {
+            root_ = new_path(bits, tail_);
+            return;
+        }
+        if ((size_ >> bits) > (size_t(1) << shift_)) {
+            // the tree is full: it becomes the first child of a new root
+            std::unique_ptr<branch> top(new branch);
+            node *path = new_path(shift_, tail_);
+            top->children[0] = root_;
+            top->children[1] = path;
+            root_ = top.release();
+            shift_ += bits;
+            return;
+        }
+        node **slot = &root_;
+        for (unsigned level = shift_;; level -= bits) {
+            branch *b = own_branch(*slot, level);
+            node *&child = b->children[(index >> level) & mask];
+            if (level == bits) {
+                child = tail_;
+                return;
+            }
+            if (!child) {
+                child = new_path(level - bits, tail_);
+                return;
+            }
+            slot = &child;
+        }
+    }
+
+    // Drops the one-element tail: the last leaf of the tree becomes the tail
+    void pop_tail() {
+        size_t index = size_ - 2;
+        size_t new_size = size_ - 1;
+        if (new_size == width) {
+            // the tree holds just that leaf
+            leaf *last = leaf_for(index);
+            RefCount::add(last->ref_count);
+            release(root_, shift_);
+            root_ = nullptr;
+            shift_ = bits;
+            release(tail_, 0);
+            tail_ = last;
+            size_ = new_size;
+            return;
+        }
+        branch *path[max_depth];
+        unsigned depth = 0;
+        node **slot = &root_;
+        for (unsigned level = shift_; level != 0; level -= bits) {
+            path[depth++] = own_branch(*slot, level);
+            slot = &path[depth - 1]->children[(index >> level) & mask];
+        }
+        // from here on nothing throws
+        release(tail_, 0);
+        tail_ = static_cast<leaf *>(*slot);
+        *slot = nullptr;
+        // branches whose only child was that leaf are empty now
+        for (unsigned d = depth - 1, level = bits; d != 0 && ((index >> level) & mask) == 0; --d, level += bits) {
+            delete path[d];
+            path[d - 1]->children[(index >> (level + bits)) & mask] = nullptr;
+        }
+        size_ = new_size;
+        while (shift_ > bits && !static_cast<branch *>(root_)->children[1]) {
+            branch *old = static_cast<branch *>(root_);
+            root_ = old->children[0];
+            delete old;
+            shift_ -= bits;
+        }
+    }
+
+    size_t size_ = 0;
+    // level of the root: its children cover 1 << shift_ elements each
+    unsigned shift_ = bits;
+    node *root_ = nullptr;
+    leaf *tail_ = nullptr;
+};
@@ -0,0 +1,312 @@
+#pragma once
+
+#include "index_iterator.h"
+#include "vector.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Vector whose storage is a table of chunks of FirstChunk, 2 * FirstChunk,
+// 4 * FirstChunk... elements. Growth allocates the next chunk and never moves an
+// element, so addresses stay valid until the element is erased, and no growth step
+// holds two copies of the data. The chunk of an index follows from its highest set
+// bit, so indexing stays O(1). Copies are deep: shared storage would have to move
+// elements on a write. flatten() builds the contiguous layout when one is needed.
+template<typename T, size_t FirstChunk = 16, typename Allocator = std::allocator<T>>
+struct segmented_vector : private allocator_holder<Allocator> {
+    static_assert(FirstChunk != 0 && (FirstChunk & (FirstChunk - 1)) == 0, "FirstChunk must be a power of two");
+
+    typedef T value_type;
+    typedef Allocator allocator_type;
+
+private:
+    typedef std::allocator_traits<Allocator> traits;
+
+    static constexpr unsigned first_bits = __builtin_ctzll(FirstChunk);
+    static constexpr unsigned max_chunks = sizeof(size_t) * 8 - first_bits;
+
+    static constexpr size_t chunk_size(unsigned k) noexcept {
+        return FirstChunk << k;
+    }
+
+    struct position {
+        unsigned chunk;
+        size_t offset;
+    };
+
+    static position locate(size_t index) noexcept {
+        size_t j = index + FirstChunk;
+        unsigned k = (unsigned) (sizeof(unsigned long long) * 8 - 1 - __builtin_clzll(j)) - first_bits;
+        return {k, j - chunk_size(k)};
+    }
+
+public:
+    typedef index_iterator<segmented_vector> iterator;
+    typedef index_iterator<segmented_vector const> const_iterator;
+
+    segmented_vector() = default;
+
+    explicit segmented_vector(Allocator const &alloc) noexcept : allocator_holder<Allocator>(alloc) {}
+
+    segmented_vector(std::initializer_list<T> init, Allocator const &alloc = Allocator())
+            : segmented_vector(init.begin(), init.end(), alloc) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    segmented_vector(InputIterator beg, InputIterator en, Allocator const &alloc = Allocator())
+            : segmented_vector(alloc) {
+        if constexpr (is_forward_iterator<InputIterator>) {
+            reserve((size_t) std::distance(beg, en));
+        }
+        for (; beg != en; ++beg) {
+            emplace_back(*beg);
+        }
+    }
+
+    segmented_vector(segmented_vector const &other)
+            : segmented_vector(traits::select_on_container_copy_construction(other.get_allocator())) {
+        reserve(other.size_);
+        other.for_each_segment([this](T const *first, size_t n) {
+            for (T const *p = first; p != first + n; ++p) {
+                emplace_back(*p);
+            }
+        });
+    }
+
+    segmented_vector(segmented_vector &&other) noexcept : allocator_holder<Allocator>(other.allocator()) {
+        steal(other);
+    }
+
+    segmented_vector &operator=(segmented_vector const &other) {
+        if (this != &other) {
+            segmented_vector(other).swap(*this);
+        }
+        return *this;
+    }
+
+    segmented_vector &operator=(segmented_vector &&other) noexcept {
+        segmented_vector(std::move(other)).swap(*this);
+        return *this;
+    }
+
+    ~segmented_vector() {
+        clear();
+        release_chunks(0);
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return this->allocator();
+    }
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    size_t capacity() const noexcept {
+        return chunk_count_ ? chunk_size(chunk_count_) - FirstChunk : 0;
+    }
+
+    T &operator[](size_t index) noexcept {
+        position p = locate(index);
+        return chunks_[p.chunk][p.offset];
+    }
+
+    T const &operator[](size_t index) const noexcept {
+        position p = locate(index);
+        return chunks_[p.chunk][p.offset];
+    }
+
+    T &front() noexcept {
+        return chunks_[0][0];
+    }
+
+    T const &front() const noexcept {
+        return chunks_[0][0];
+    }
+
+    T &back() noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    T const &back() const noexcept {
+        return (*this)[size_ - 1];
+    }
+
+    iterator begin() noexcept {
+        return iterator(this, 0);
+    }
+
+    iterator end() noexcept {
+        return iterator(this, size_);
+    }
+
+    const_iterator begin() const noexcept {
+        return const_iterator(this, 0);
+    }
+
+    const_iterator end() const noexcept {
+        return const_iterator(this, size_);
+    }
+
+    // Calls f(first, n) for each run of contiguous elements, in order
+    template<typename F>
+    void for_each_segment(F f) const {
+        size_t left = size_;
+        for (unsigned k = 0; left != 0; ++k) {
+            size_t n = std::min(left, chunk_size(k));
+            f(static_cast<T const *>(chunks_[k]), n);
+            left -= n;
+        }
+    }
+
+    template<typename F>
+    void for_each_segment(F f) {
+        size_t left = size_;
+        for (unsigned k = 0; left != 0; ++k) {
+            size_t n = std::min(left, chunk_size(k));
+            f(chunks_[k], n);
+            left -= n;
+        }
+    }
+
+    // Allocates chunks until cp elements fit; existing elements stay where they are
+    void reserve(size_t cp) {
+        while (capacity() < cp) {
+            if (chunk_count_ + 1 == max_chunks) {
+                throw std::length_error("segmented_vector is too big");
+            }
+            chunks_[chunk_count_] = traits::allocate(this->allocator(), chunk_size(chunk_count_));
+            ++chunk_count_;
+        }
+    }
+
+    // Frees the chunks that hold no elements
+    void shrink_to_fit() noexcept {
+        release_chunks(size_ ? locate(size_ - 1).chunk + 1 : 0);
+    }
+
+    void push_back(T const &value) {
+        emplace_back(value);
+    }
+
+    void push_back(T &&value) {
+        emplace_back(std::move(value));
+    }
+
+    // Nothing moves on growth, so args may refer to our own elements
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (size_ == capacity()) {
+            reserve(size_ + 1);
+        }
+        T *slot = &(*this)[size_];
+        traits::construct(this->allocator(), slot, std::forward<Args>(args)...);
+        ++size_;
+        return *slot;
+    }
+
+    void pop_back() {
+        if (size_ == 0) {
+            throw std::runtime_error("attempt to pop_back in empty segmented_vector");
+        }
+        traits::destroy(this->allocator(), &back());
+        --size_;
+    }
+
+    void resize(size_t sz) {
+        reserve(sz);
+        while (size_ < sz) {
+            emplace_back();
+        }
+        while (size_ > sz) {
+            pop_back();
+        }
+    }
+
+    void resize(size_t sz, T const &elem) {
+        reserve(sz);
+        while (size_ < sz) {
+            emplace_back(elem);
+        }
+        while (size_ > sz) {
+            pop_back();
+        }
+    }
+
+    void clear() noexcept {
+        while (size_ != 0) {
+            traits::destroy(this->allocator(), &back());
+            --size_;
+        }
+    }
+
+    // The elements in one contiguous block
+    template<typename Vector = vector<T>>
+    Vector flatten() const {
+        if constexpr (std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>) {
+            Vector result;
+            result.reserve(size_);
+            result.reserve_and_write(size_, [this](T *dst, size_t) {
+                for_each_segment([&dst](T const *first, size_t n) {
+                    std::memcpy(static_cast<void *>(dst), first, n * sizeof(T));
+                    dst += n;
+                });
+                return size_;
+            });
+            return result;
+        } else {
+            return Vector(begin(), end());
+        }
+    }
+
+    void swap(segmented_vector &other) noexcept {
+        using std::swap;
+        swap(this->allocator(), other.allocator());
+        std::swap(chunks_, other.chunks_);
+        std::swap(chunk_count_, other.chunk_count_);
+        std::swap(size_, other.size_);
+    }
+
+    friend void swap(segmented_vector &a, segmented_vector &b) noexcept {
+        a.swap(b);
+    }
+
+    friend bool operator==(segmented_vector const &a, segmented_vector const &b) {
+        return a.size_ == b.size_ && std::equal(a.begin(), a.end(), b.begin());
+    }
+
+    friend bool operator!=(segmented_vector const &a, segmented_vector const &b) {
+        return !(a == b);
+    }
+
+private:
+    void steal(segmented_vector &other) noexcept {
+        std::copy(other.chunks_, other.chunks_ + other.chunk_count_, chunks_);
+        chunk_count_ = other.chunk_count_;
+        size_ = other.size_;
+        other.chunk_count_ = 0;
+        other.size_ = 0;
+    }
+
+    // Frees chunks [keep, chunk_count_), which must hold no elements
+    void release_chunks(unsigned keep) noexcept {
+        while (chunk_count_ > keep) {
+            --chunk_count_;
+            traits::deallocate(this->allocator(), chunks_[chunk_count_], chunk_size(chunk_count_));
+            chunks_[chunk_count_] = nullptr;
+        }
+    }
+
+    T *chunks_[max_chunks] = {};
+    unsigned chunk_count_ = 0;
+    size_t size_ = 0;
+};
@@ -0,0 +1,207 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cstddef>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Rows of Fields... stored column by column: each field lives in a vector of its
+// own, so a scan over one field touches only that field's cache lines and gets a
+// plain contiguous array. Columns share storage with copies independently, and a
+// write copies only the column it changes.
+template<typename... Fields>
+struct soa_vector {
+    static_assert(sizeof...(Fields) > 0, "soa_vector needs at least one field");
+
+    typedef std::tuple<Fields...> value_type;
+    typedef std::tuple<vector<Fields>...> columns_type;
+
+    static constexpr size_t field_count = sizeof...(Fields);
+
+    template<size_t I>
+    using field_type = std::tuple_element_t<I, value_type>;
+
+    // Proxy for row index of owner; reading or writing field I goes to column I only
+    template<typename Owner>
+    struct basic_reference {
+        basic_reference(Owner &owner, size_t index) noexcept : owner_(&owner), index_(index) {}
+
+        template<size_t I>
+        decltype(auto) get() const {
+            return std::get<I>(owner_->columns_)[index_];
+        }
+
+        operator value_type() const {
+            return row(std::index_sequence_for<Fields...>());
+        }
+
+        template<typename Tuple, typename O = Owner, typename = std::enable_if_t<!std::is_const_v<O>>>
+        basic_reference const &operator=(Tuple const &values) const {
+            assign(values, std::index_sequence_for<Fields...>());
+            return *this;
+        }
+
+        size_t index() const noexcept {
+            return index_;
+        }
+
+    private:
+        template<size_t... I>
+        value_type row(std::index_sequence<I...>) const {
+            return value_type(std::as_const(std::get<I>(owner_->columns_))[index_]...);
+        }
+
+        template<typename Tuple, size_t... I>
+        void assign(Tuple const &values, std::index_sequence<I...>) const {
+            ((std::get<I>(owner_->columns_)[index_] = std::get<I>(values)), ...);
+        }
+
+        Owner *owner_;
+        size_t index_;
+    };
+
+    typedef basic_reference<soa_vector> reference;
+    typedef basic_reference<soa_vector const> const_reference;
+
+    soa_vector() = default;
+
+    size_t size() const noexcept {
+        return std::get<0>(columns_).size();
+    }
+
+    bool empty() const noexcept {
+        return size() == 0;
+    }
+
+    // Read-only view of one field for every row; never copies
+    template<size_t I>
+    span<field_type<I> const> column() const noexcept {
+        return std::get<I>(columns_).const_span();
+    }
+
+    // Writable view of one field; copies that column alone if it is shared
+    template<size_t I>
+    span<field_type<I>> mutable_column() {
+        return std::get<I>(columns_).mutable_span();
+    }
+
+    reference operator[](size_t index) noexcept {
+        return reference(*this, index);
+    }
+
+    const_reference operator[](size_t index) const noexcept {
+        return const_reference(*this, index);
+    }
+
+    reference front() noexcept {
+        return (*this)[0];
+    }
+
+    reference back() noexcept {
+        return (*this)[size() - 1];
+    }
+
+    const_reference front() const noexcept {
+        return (*this)[0];
+    }
+
+    const_reference back() const noexcept {
+        return (*this)[size() - 1];
+    }
+
+    void reserve(size_t cp) {
+        std::apply([cp](auto &... column) {
+            (column.reserve(cp), ...);
+        }, columns_);
+    }
+
+    void shrink_to_fit() {
+        std::apply([](auto &... column) {
+            (column.shrink_to_fit(), ...);
+        }, columns_);
+    }
+
+    // Strong guarantee: if a column throws, the columns already extended are shortened back
+    void push_back(Fields... values) {
+        push_columns<0>(values...);
+    }
+
+    void pop_back() {
+        if (empty()) {
+            throw std::runtime_error("attempt to pop_back in empty soa_vector");
+        }
+        resize(size() - 1);
+    }
+
+    // New rows are value-initialized; if a column throws, all keep their old size
+    void resize(size_t sz) {
+        if (sz >= size()) {
+            grow_columns<0>(sz, size());
+            return;
+        }
+        // shared columns are copied up front, so nothing changes if a copy throws;
+        // the others are shortened in place once we own them alone again
+        columns_type shorter = std::apply([sz](auto const &... column) {
+            return columns_type(shortened(column, sz)...);
+        }, columns_);
+        columns_ = std::move(shorter);
+        std::apply([sz](auto &... column) {
+            (column.resize(sz), ...);
+        }, columns_);
+    }
+
+    void clear() {
+        std::apply([](auto &... column) {
+            (column.clear(), ...);
+        }, columns_);
+    }
+
+    friend void swap(soa_vector &a, soa_vector &b) {
+        a.columns_.swap(b.columns_);
+    }
+
+    friend bool operator==(soa_vector const &a, soa_vector const &b) {
+        return a.columns_ == b.columns_;
+    }
+
+    friend bool operator!=(soa_vector const &a, soa_vector const &b) {
+        return !(a == b);
+    }
+
+private:
+    template<size_t I, typename Head, typename... Tail>
+    void push_columns(Head &head, Tail &... tail) {
+        std::get<I>(columns_).push_back(std::move(head));
+        if constexpr (I + 1 < field_count) {
+            try {
+                push_columns<I + 1>(tail...);
+            } catch (...) {
+                std::get<I>(columns_).pop_back();
+                throw;
+            }
+        }
+    }
+
+    template<typename Column>
+    static Column shortened(Column const &column, size_t sz) {
+        return column.shared() ? Column(column.begin(), column.begin() + sz) : column;
+    }
+
+    template<size_t I>
+    void grow_columns(size_t sz, size_t old_size) {
+        std::get<I>(columns_).resize(sz);
+        if constexpr (I + 1 < field_count) {
+            try {
+                grow_columns<I + 1>(sz, old_size);
+            } catch (...) {
+                std::get<I>(columns_).resize(old_size);
+                throw;
+            }
+        }
+    }
+
+    columns_type columns_;
+};
@@ -0,0 +1,537 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+// Smallest unsigned type that counts up to N
+template<size_t N>
+using static_vector_size_t = std::conditional_t<N <= UINT8_MAX, uint8_t,
+        std::conditional_t<N <= UINT16_MAX, uint16_t, std::conditional_t<N <= UINT32_MAX, uint32_t, size_t>>>;
+
+template<typename T>
+constexpr bool is_static_vector_trivial = std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T> &&
+                                          std::is_trivially_destructible_v<T>;
+
+// Up to this many bytes of trivial elements live in a plain array, so the vector is a
+// literal type. The price is zero-filling all N slots on construction and copying
+// all of them, which constant evaluation requires and which only stays cheap while small.
+constexpr size_t static_vector_literal_bytes = 64;
+
+template<typename T, size_t N>
+constexpr bool is_static_vector_literal = is_static_vector_trivial<T> && sizeof(T) * N <= static_vector_literal_bytes;
+
+// Small trivial T: the elements past size() are value-initialized once
+template<typename T, size_t N, bool Literal = is_static_vector_literal<T, N>>
+struct static_vector_storage {
+    constexpr T *elems() noexcept {
+        return elems_;
+    }
+
+    constexpr T const *elems() const noexcept {
+        return elems_;
+    }
+
+    template<typename... Args>
+    constexpr void construct(size_t index, Args &&... args) {
+        elems_[index] = T(std::forward<Args>(args)...);
+    }
+
+    constexpr void destroy(size_t) noexcept {}
+
+    T elems_[N] = {};
+    static_vector_size_t<N> size_ = 0;
+};
+
+// Other T lives in raw bytes and is constructed in place; only size() elements are
+// ever written or copied, with memcpy for trivial T
+template<typename T, size_t N>
+struct static_vector_storage<T, N, false> {
+    static_vector_storage() = default;
+
+    static_vector_storage(static_vector_storage const &other) {
+        if constexpr (is_static_vector_trivial<T>) {
+            copy_bytes(other);
+        } else {
+            construct_from(other.elems(), other.size_);
+        }
+    }
+
+    static_vector_storage(static_vector_storage &&other) noexcept(std::is_nothrow_move_constructible_v<T>) {
+        if constexpr (is_static_vector_trivial<T>) {
+            copy_bytes(other);
+        } else {
+            construct_from(std::make_move_iterator(other.elems()), other.size_);
+        }
+        other.clear();
+    }
+
+    static_vector_storage &operator=(static_vector_storage const &other) {
+        if constexpr (is_static_vector_trivial<T>) {
+            copy_bytes(other);
+        } else if (this != &other) {
+            assign_from(other.elems(), other.size_);
+        }
+        return *this;
+    }
+
+    static_vector_storage &operator=(static_vector_storage &&other) noexcept(std::is_nothrow_move_assignable_v<T> &&
+                                                                            std::is_nothrow_move_constructible_v<T>) {
+        if constexpr (is_static_vector_trivial<T>) {
+            copy_bytes(other);
+        } else if (this != &other) {
+            assign_from(std::make_move_iterator(other.elems()), other.size_);
+        }
+        if (this != &other) {
+            other.clear();
+        }
+        return *this;
+    }
+
+    ~static_vector_storage() {
+        clear();
+    }
+
+    T *elems() noexcept {
+        return std::launder(reinterpret_cast<T *>(raw_));
+    }
+
+    T const *elems() const noexcept {
+        return std::launder(reinterpret_cast<T const *>(raw_));
+    }
+
+    template<typename... Args>
+    void construct(size_t index, Args &&... args) {
+        new(raw_ + index * sizeof(T)) T(std::forward<Args>(args)...);
+    }
+
+    void destroy(size_t index) noexcept {
+        std::destroy_at(elems() + index);
+    }
+
+private:
+    void clear() noexcept {
+        while (size_ != 0) {
+            --size_;
+            destroy(size_);
+        }
+    }
+
+    void copy_bytes(static_vector_storage const &other) noexcept {
+        if (this != &other) {
+            std::memcpy(raw_, other.raw_, other.size_ * sizeof(T));
+            size_ = other.size_;
+        }
+    }
+
+    // For the constructors, whose failure does not run the destructor: a throwing
+    // copy or move destroys the elements built so far here
+    template<typename Iterator>
+    void construct_from(Iterator first, size_t n) {
+        try {
+            for (; size_ != n; ++size_, ++first) {
+                construct(size_, *first);
+            }
+        } catch (...) {
+            clear();
+            throw;
+        }
+    }
+
+    // Assigns over the common prefix, then constructs or destroys the difference
+    template<typename Iterator>
+    void assign_from(Iterator first, size_t n) {
+        size_t common = std::min<size_t>(size_, n);
+        for (size_t i = 0; i != common; ++i, ++first) {
+            elems()[i] = *first;
+        }
+        for (; size_ < n; ++size_, ++first) {
+            construct(size_, *first);
+        }
+        while (size_ > n) {
+            --size_;
+            destroy(size_);
+        }
+    }
+
+public:
+    alignas(T) unsigned char raw_[N * sizeof(T)];
+    static_vector_size_t<N> size_ = 0;
+};
+
+// Vector with the interface of vector and room for exactly N elements inline, for hot
+// paths with a known bound. It never allocates: growing past N throws
+// std::length_error. For trivial T filling at most static_vector_literal_bytes it is a
+// literal type and every operation is constexpr; bigger ones leave unused slots
+// unwritten and copy only size() elements. Copies are deep, iterators are plain pointers.
+template<typename T, size_t N>
+struct static_vector : private static_vector_storage<T, N> {
+    static_assert(N > 0, "static_vector needs room for at least one element");
+
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+    typedef T &reference;
+    typedef T const &const_reference;
+    typedef T *iterator;
+    typedef T const *const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    constexpr static_vector() noexcept = default;
+
+    constexpr static_vector(std::initializer_list<T> init) : static_vector(init.begin(), init.end()) {}
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    constexpr static_vector(InputIterator beg, InputIterator en) {
+        for (; beg != en; ++beg) {
+            emplace_back(*beg);
+        }
+    }
+
+    constexpr static_vector(size_t cnt, T const &elem) {
+        resize(cnt, elem);
+    }
+
+    constexpr explicit static_vector(size_t cnt) {
+        resize(cnt);
+    }
+
+    constexpr static_vector &operator=(std::initializer_list<T> init) {
+        assign(init.begin(), init.end());
+        return *this;
+    }
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    constexpr void assign(InputIterator beg, InputIterator en) {
+        clear();
+        for (; beg != en; ++beg) {
+            emplace_back(*beg);
+        }
+    }
+
+    constexpr void assign(std::initializer_list<T> init) {
+        assign(init.begin(), init.end());
+    }
+
+    constexpr T &operator[](size_t index) noexcept {
+        return data()[index];
+    }
+
+    constexpr T const &operator[](size_t index) const noexcept {
+        return data()[index];
+    }
+
+    constexpr T const &unchecked_at(size_t index) const noexcept {
+        return data()[index];
+    }
+
+    constexpr T &checked_at(size_t index) {
+        if (index >= size()) {
+            throw std::runtime_error("static_vector index out of range");
+        }
+        return data()[index];
+    }
+
+    constexpr T const &checked_at(size_t index) const {
+        if (index >= size()) {
+            throw std::runtime_error("static_vector index out of range");
+        }
+        return data()[index];
+    }
+
+    constexpr T &front() noexcept {
+        return data()[0];
+    }
+
+    constexpr T const &front() const noexcept {
+        return data()[0];
+    }
+
+    constexpr T &back() noexcept {
+        return data()[size() - 1];
+    }
+
+    constexpr T const &back() const noexcept {
+        return data()[size() - 1];
+    }
+
+    constexpr size_t size() const noexcept {
+        return this->size_;
+    }
+
+    static constexpr size_t capacity() noexcept {
+        return N;
+    }
+
+    static constexpr size_t max_size() noexcept {
+        return N;
+    }
+
+    constexpr bool empty() const noexcept {
+        return this->size_ == 0;
+    }
+
+    constexpr bool full() const noexcept {
+        return this->size_ == N;
+    }
+
+    constexpr T *data() noexcept {
+        return this->elems();
+    }
+
+    constexpr T const *data() const noexcept {
+        return this->elems();
+    }
+
+    constexpr span<T> mutable_span() noexcept {
+        return {data(), size()};
+    }
+
+    constexpr span<T const> const_span() const noexcept {
+        return {data(), size()};
+    }
+
+    constexpr iterator begin() noexcept {
+        return data();
+    }
+
+    constexpr iterator end() noexcept {
+        return data() + size();
+    }
+
+    constexpr const_iterator begin() const noexcept {
+        return data();
+    }
+
+    constexpr const_iterator end() const noexcept {
+        return data() + size();
+    }
+
+    constexpr reverse_iterator rbegin() noexcept {
+        return reverse_iterator(end());
+    }
+
+    constexpr reverse_iterator rend() noexcept {
+        return reverse_iterator(begin());
+    }
+
+    constexpr const_reverse_iterator rbegin() const noexcept {
+        return const_reverse_iterator(end());
+    }
+
+    constexpr const_reverse_iterator rend() const noexcept {
+        return const_reverse_iterator(begin());
+    }
+
+    // Only checks the bound, so generic code that reserves keeps working
+    constexpr void reserve(size_t cap) const {
+        if (cap > N) {
+            throw std::length_error("static_vector is full");
+        }
+    }
+
+    constexpr void shrink_to_fit() const noexcept {}
+
+    constexpr void push_back(T const &elem) {
+        emplace_back(elem);
+    }
+
+    constexpr void push_back(T &&elem) {
+        emplace_back(std::move(elem));
+    }
+
+    // Nothing moves, so args may refer to our own elements
+    template<typename... Args>
+    constexpr T &emplace_back(Args &&... args) {
+        reserve(size() + 1);
+        this->construct(size(), std::forward<Args>(args)...);
+        ++this->size_;
+        return back();
+    }
+
+    constexpr void pop_back() {
+        if (empty()) {
+            throw std::runtime_error("attempt to pop_back in empty static_vector");
+        }
+        --this->size_;
+        this->destroy(size());
+    }
+
+    constexpr void resize(size_t sz) {
+        reserve(sz);
+        while (size() < sz) {
+            emplace_back();
+        }
+        while (size() > sz) {
+            pop_back();
+        }
+    }
+
+    constexpr void resize(size_t sz, T const &elem) {
+        reserve(sz);
+        while (size() < sz) {
+            emplace_back(elem);
+        }
+        while (size() > sz) {
+            pop_back();
+        }
+    }
+
+    constexpr iterator insert(const_iterator pos, T const &val) {
+        return emplace(pos, val);
+    }
+
+    constexpr iterator insert(const_iterator pos, T &&val) {
+        return emplace(pos, std::move(val));
+    }
+
+    template<typename... Args>
+    constexpr iterator emplace(const_iterator pos, Args &&... args) {
+        size_t index = pos - begin();
+        if (index == size()) {
+            emplace_back(std::forward<Args>(args)...);
+            return begin() + index;
+        }
+        reserve(size() + 1);
+        // args may refer to an element that is about to shift
+        T elem(std::forward<Args>(args)...);
+        emplace_back(std::move(back()));
+        for (size_t i = size() - 2; i != index; --i) {
+            data()[i] = std::move(data()[i - 1]);
+        }
+        data()[index] = std::move(elem);
+        return begin() + index;
+    }
+
+    constexpr iterator erase(const_iterator ind) {
+        return erase(ind, ind + 1);
+    }
+
+    constexpr iterator erase(const_iterator beg, const_iterator en) {
+        size_t left = beg - begin();
+        size_t right = en - begin();
+        if (left == right) {
+            return begin() + left;
+        }
+        for (size_t i = right; i != size(); ++i) {
+            data()[left + i - right] = std::move(data()[i]);
+        }
+        for (size_t i = right - left; i != 0; --i) {
+            pop_back();
+        }
+        return begin() + left;
+    }
+
+    // O(1) erase that moves the last element into pos, so the order is not kept
+    constexpr iterator swap_erase(const_iterator pos) {
+        size_t index = pos - begin();
+        if (index + 1 != size()) {
+            data()[index] = std::move(back());
+        }
+        pop_back();
+        return begin() + index;
+    }
+
+    template<typename Pred>
+    friend constexpr size_t erase_if(static_vector &v, Pred pred) {
+        size_t kept = 0;
+        for (size_t i = 0; i != v.size(); ++i) {
+            if (!pred(std::as_const(v.data()[i]))) {
+                if (kept != i) {
+                    v.data()[kept] = std::move(v.data()[i]);
+                }
+                ++kept;
+            }
+        }
+        size_t removed = v.size() - kept;
+        while (v.size() != kept) {
+            v.pop_back();
+        }
+        return removed;
+    }
+
+    constexpr void clear() noexcept {
+        while (this->size_ != 0) {
+            --this->size_;
+            this->destroy(this->size_);
+        }
+    }
+
+    template<typename Vector = vector<T>>
+    Vector to_vector() const {
+        return Vector(begin(), end());
+    }
+
+    // Exchanges the elements one by one: there is no storage to swap
+    constexpr void swap(static_vector &other) {
+        static_vector &longer = size() < other.size() ? other : *this;
+        static_vector &shorter = size() < other.size() ? *this : other;
+        size_t common = shorter.size();
+        for (size_t i = 0; i != common; ++i) {
+            using std::swap;
+            swap(data()[i], other.data()[i]);
+        }
+        for (size_t i = common; i != longer.size(); ++i) {
+            shorter.emplace_back(std::move(longer.data()[i]));
+        }
+        while (longer.size() != common) {
+            longer.pop_back();
+        }
+    }
+
+    friend constexpr void swap(static_vector &a, static_vector &b) {
+        a.swap(b);
+    }
+
+    // Plain loops: the std algorithms are not constexpr before C++20
+    friend constexpr bool operator==(static_vector const &a, static_vector const &b) {
+        if (a.size() != b.size()) {
+            return false;
+        }
+        for (size_t i = 0; i != a.size(); ++i) {
+            if (!(a[i] == b[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    friend constexpr bool operator!=(static_vector const &a, static_vector const &b) {
+        return !(a == b);
+    }
+
+    friend constexpr bool operator<(static_vector const &a, static_vector const &b) {
+        size_t n = a.size() < b.size() ? a.size() : b.size();
+        for (size_t i = 0; i != n; ++i) {
+            if (a[i] < b[i]) {
+                return true;
+            }
+            if (b[i] < a[i]) {
+                return false;
+            }
+        }
+        return a.size() < b.size();
+    }
+
+    friend constexpr bool operator>(static_vector const &a, static_vector const &b) {
+        return b < a;
+    }
+
+    friend constexpr bool operator<=(static_vector const &a, static_vector const &b) {
+        return !(a > b);
+    }
+
+    friend constexpr bool operator>=(static_vector const &a, static_vector const &b) {
+        return !(a < b);
+    }
+};
@@ -2,72 +2,418 @@
 
 #include <cstdint>
 #include <cstdlib>
+#include <cstring>
+#include <functional>
 #include <stdexcept>
 #include <memory>
-#include <variant>
+#include <new>
 #include <algorithm>
+#include <initializer_list>
+#include <iterator>
+#include <atomic>
+#include <type_traits>
+#include <utility>
 
+#include "vector_simd.h"
+#include "vector_stats.h"
+
+// Specialize for types whose objects may be moved around with memcpy
+// (the moved-from bytes are then freed without calling the destructor).
+template<typename T>
+struct is_trivially_relocatable : std::is_trivially_copyable<T> {
+};
+
+// Non-owning pointer + length over contiguous elements
 template<typename T>
+struct span {
+    typedef T value_type;
+    typedef T *iterator;
+
+    span() noexcept = default;
+
+    span(T *ptr, size_t len) noexcept : ptr_(ptr), len_(len) {}
+
+    T &operator[](size_t index) const noexcept {
+        return ptr_[index];
+    }
+
+    T *data() const noexcept {
+        return ptr_;
+    }
+
+    size_t size() const noexcept {
+        return len_;
+    }
+
+    bool empty() const noexcept {
+        return len_ == 0;
+    }
+
+    T *begin() const noexcept {
+        return ptr_;
+    }
+
+    T *end() const noexcept {
+        return ptr_ + len_;
+    }
+
+    // The count elements from offset on; the caller keeps them within the view
+    span subspan(size_t offset, size_t count) const noexcept {
+        return span(ptr_ + offset, count);
+    }
+
+private:
+    T *ptr_ = nullptr;
+    size_t len_ = 0;
+};
+
+// Reference counting policies for bigvector storage. release() returns true
+// when the caller held the last reference and must free the storage.
+struct plain_ref_count {
+    typedef size_t counter;
+
+    static bool unique(counter const &c) noexcept {
+        return c == 1;
+    }
+
+    static void add(counter &c) noexcept {
+        ++c;
+    }
+
+    static bool release(counter &c) noexcept {
+        return --c == 0;
+    }
+};
+
+// Safe for sharing copies between threads (each vector object is still used by one thread at a time)
+struct atomic_ref_count {
+    typedef std::atomic<size_t> counter;
+
+    static bool unique(counter const &c) noexcept {
+        // acquire: writes we are about to make must not race with reads of the last other owner
+        return c.load(std::memory_order_acquire) == 1;
+    }
+
+    static void add(counter &c) noexcept {
+        c.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static bool release(counter &c) noexcept {
+        // the sole owner has nobody to race with and skips the RMW
+        return c.load(std::memory_order_acquire) == 1 || c.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+};
+
+// Keeps an allocator without spending space on stateless ones
+template<typename Allocator, bool = std::is_empty_v<Allocator> && !std::is_final_v<Allocator>>
+struct allocator_holder : private Allocator {
+    allocator_holder() = default;
+
+    explicit allocator_holder(Allocator const &alloc) noexcept : Allocator(alloc) {}
+
+    Allocator &allocator() noexcept {
+        return *this;
+    }
+
+    Allocator const &allocator() const noexcept {
+        return *this;
+    }
+};
+
+template<typename Allocator>
+struct allocator_holder<Allocator, false> {
+    allocator_holder() = default;
+
+    explicit allocator_holder(Allocator const &alloc) noexcept : alloc_(alloc) {}
+
+    Allocator &allocator() noexcept {
+        return alloc_;
+    }
+
+    Allocator const &allocator() const noexcept {
+        return alloc_;
+    }
+
+private:
+    Allocator alloc_;
+};
+
+// Growth policies: grow(cp) is the capacity to reallocate to once cp elements are in use
+struct doubling_growth {
+    static size_t grow(size_t cp) noexcept {
+        return cp > 0 ? cp * 2 : 2;
+    }
+};
+
+struct one_and_half_growth {
+    static size_t grow(size_t cp) noexcept {
+        return cp > 1 ? cp + cp / 2 : 2;
+    }
+};
+
+// Doubles until a step would exceed MaxStep elements, then grows by MaxStep at a time
+template<size_t MaxStep>
+struct capped_growth {
+    static_assert(MaxStep > 0, "capped_growth needs a positive step");
+
+    static size_t grow(size_t cp) noexcept {
+        return cp + std::max<size_t>(std::min(cp, MaxStep), 2);
+    }
+};
+
+// Allocators may report the real size of a block, as C++23 allocate_at_least does
+template<typename Alloc, typename = void>
+struct has_allocate_at_least : std::false_type {
+};
+
+template<typename Alloc>
+struct has_allocate_at_least<Alloc, std::void_t<decltype(std::declval<Alloc &>().allocate_at_least(size_t()))>>
+        : std::true_type {
+};
+
+// Allocators may resize a block keeping its bytes, possibly moving it: reallocate(ptr, old_n, new_n)
+template<typename Alloc, typename = void>
+struct has_reallocate : std::false_type {
+};
+
+template<typename Alloc>
+struct has_reallocate<Alloc, std::void_t<decltype(std::declval<Alloc &>().reallocate(
+        std::declval<typename Alloc::value_type *>(), size_t(), size_t()))>> : std::true_type {
+};
+
+// Persistent allocators hand back a block an earlier owner left behind: adopt() -> {ptr, count}
+template<typename Alloc, typename = void>
+struct has_adopt : std::false_type {
+};
+
+template<typename Alloc>
+struct has_adopt<Alloc, std::void_t<decltype(std::declval<Alloc &>().adopt())>> : std::true_type {
+};
+
+// Tag for the vector constructor that takes over the allocator's existing storage
+struct adopt_storage_t {
+    explicit adopt_storage_t() = default;
+};
+
+inline constexpr adopt_storage_t adopt_storage{};
+
+template<typename Vector>
+struct vector_slice;
+
+template<typename It>
+using iterator_category_t = typename std::iterator_traits<It>::iterator_category;
+
+template<typename It>
+constexpr bool is_forward_iterator = std::is_base_of_v<std::forward_iterator_tag, iterator_category_t<It>>;
+
+template<typename T, size_t SmallSize = 1, typename RefCount = plain_ref_count, typename Allocator = std::allocator<T>,
+        typename Growth = doubling_growth>
 
 struct vector {
-    struct bigvector {
+    static_assert(SmallSize > 0, "vector needs room for at least one inline element");
+
+    typedef vector_stats<T> stats;
+
+    struct bigvector : allocator_holder<Allocator> {
         struct storage {
             size_t size_;
             size_t capacity_;
-            size_t ref_count;
+            typename RefCount::counter ref_count;
+            std::atomic<size_t> hash_;  // 0 until hash() computes it, reset by every write, hash_writable while
+                                        // a mutable reference may be live
             T data[];  // flexible size, using to make_storage() comfortably
         };
         storage *store = nullptr;
 
+        typedef typename std::allocator_traits<Allocator>::template rebind_alloc<storage> storage_allocator;
+        typedef std::allocator_traits<storage_allocator> storage_traits;
+
+        // header and elements are allocated as a whole number of storage-sized units
+        static size_t storage_units(size_t cp) noexcept {
+            return 1 + (sizeof(T) * cp + sizeof(storage) - 1) / sizeof(storage);
+        }
+
+        // The returned storage is referenced once and has capacity_ >= cp; size_ is left to the caller
+        // capacity_ ends up larger when the allocator reports a bigger block via allocate_at_least
         storage *make_storage(size_t cp) {
-            return static_cast<storage *> (operator new(sizeof(storage) + sizeof(T) * cp));
+            storage_allocator alloc(this->allocator());
+            storage *tmp;
+            if constexpr (has_allocate_at_least<storage_allocator>::value) {
+                auto result = alloc.allocate_at_least(storage_units(cp));
+                tmp = result.ptr;
+                cp = std::max(cp, (result.count - 1) * sizeof(storage) / sizeof(T));
+            } else {
+                tmp = storage_traits::allocate(alloc, storage_units(cp));
+            }
+            new(&tmp->ref_count) typename RefCount::counter(1);
+            new(&tmp->hash_) std::atomic<size_t>(0);
+            tmp->capacity_ = cp;
+            stats::on_allocate(storage_units(cp) * sizeof(storage), cp);
+            return tmp;
+        }
+
+        // Unshared storage of trivially relocatable elements is resized through the allocator
+        static constexpr bool reallocates =
+                has_reallocate<storage_allocator>::value && is_trivially_relocatable<T>::value;
+
+        // Only when reallocates and we hold unshared storage
+        void reallocate_storage(size_t cp) {
+            storage_allocator alloc(this->allocator());
+            size_t old_units = storage_units(store->capacity_);
+            store = alloc.reallocate(store, old_units, storage_units(cp));
+            store->capacity_ = cp;
+            stats::on_deallocate(old_units * sizeof(storage));
+            stats::on_allocate(storage_units(cp) * sizeof(storage), cp);
+            stats::on_reallocate();
+        }
+
+        void free_storage(storage *s) noexcept {
+            storage_allocator alloc(this->allocator());
+            stats::on_deallocate(storage_units(s->capacity_) * sizeof(storage));
+            storage_traits::deallocate(alloc, s, storage_units(s->capacity_));
+        }
+
+        // all owners of a storage hold equal allocators, so any of them may free it
+        void drop(storage *s) noexcept {
+            if (RefCount::release(s->ref_count)) {
+                std::destroy(s->data, s->data + s->size_);
+                free_storage(s);
+            }
+        }
+
+        bool shared() const noexcept {
+            return store && !RefCount::unique(store->ref_count);
+        }
+
+        // hash_ value of a store whose elements may change behind our back, through a
+        // reference, span or iterator handed out earlier; hash() does not cache then
+        static constexpr size_t hash_writable = 1;
+
+        // Writers must call this (or unique_copy()) before changing elements of an unshared store
+        void invalidate_hash() noexcept {
+            if (store && store->hash_.load(std::memory_order_relaxed) > hash_writable) {
+                store->hash_.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Callers that hand out mutable access to elements call this after unique_copy()
+        void mark_writable() noexcept {
+            if (store && store->hash_.load(std::memory_order_relaxed) != hash_writable) {
+                store->hash_.store(hash_writable, std::memory_order_relaxed);
+            }
+        }
+
+        // Once shared the store only changes after a detach, so the hash may be cached again
+        void share() noexcept {
+            RefCount::add(store->ref_count);
+            if (store->hash_.load(std::memory_order_relaxed) == hash_writable) {
+                store->hash_.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        // Combines std::hash of every element; never 0 or hash_writable
+        static size_t hash_elements(T const *first, T const *last) {
+            size_t h = last - first;
+            for (; first != last; ++first) {
+                h ^= std::hash<T>()(*first) + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+            }
+            return h > hash_writable ? h : h + 2;
+        }
+
+        // Cached in the storage, so copies sharing it hash once
+        size_t hash() const {
+            if (!store) {
+                return hash_elements(nullptr, nullptr);
+            }
+            size_t h = store->hash_.load(std::memory_order_relaxed);
+            if (h == hash_writable) {
+                return hash_elements(begin(), end());
+            }
+            if (h == 0) {
+                h = hash_elements(begin(), end());
+                store->hash_.store(h, std::memory_order_relaxed);
+            }
+            return h;
         }
 
         void unique_copy() {
-            if (!store || store->ref_count == 1) {
+            if (!shared()) {
+                invalidate_hash();
                 return;
             }
             storage *tmp = make_storage(store->capacity_);
             try {
                 std::uninitialized_copy(begin(), end(), tmp->data);
             } catch (...) {
-                operator delete(tmp);
+                free_storage(tmp);
                 throw;
             }
             tmp->size_ = store->size_;
-            tmp->capacity_ = store->capacity_;
-            tmp->ref_count = 1;
-            store->ref_count--;
+            stats::on_detach(tmp->size_ * sizeof(T));
+            stats::on_copy(tmp->size_);
+            drop(store);
             store = tmp;
         }
 
         //  Constructors
 
-        bigvector() noexcept = default;
+        bigvector() noexcept(std::is_nothrow_default_constructible_v<Allocator>) = default;
+
+        explicit bigvector(Allocator const &alloc) noexcept : allocator_holder<Allocator>(alloc) {}
 
-        bigvector(bigvector const &other) noexcept : store(other.store) {
+        bigvector(bigvector const &other) noexcept : allocator_holder<Allocator>(other.allocator()),
+                                                     store(other.store) {
             if (store) {
-                store->ref_count++;
+                share();
             }
         }
 
-        template<typename InputIterator>
-        bigvector(InputIterator beg, InputIterator en) {
-            ptrdiff_t len = std::distance(beg, en);
-            if (len <= 0) {
-                store = nullptr;
+        // Shares other's storage when alloc can free it, deep-copies otherwise
+        bigvector(bigvector const &other, Allocator const &alloc) : allocator_holder<Allocator>(alloc) {
+            if (!other.store) {
+                return;
+            }
+            if (this->allocator() == other.allocator()) {
+                store = other.store;
+                share();
             } else {
-                store = make_storage((size_t) len);
-                try {
-                    std::uninitialized_copy(begin(), end(), store->data);
-                } catch (...) {
-                    operator delete(store);
-                    throw;
-                }
+                copy_from(other.begin(), other.end());
+            }
+        }
+
+        bigvector(bigvector &&other) noexcept : allocator_holder<Allocator>(other.allocator()), store(other.store) {
+            other.store = nullptr;
+        }
+
+        // Takes the block the allocator kept from an earlier owner, or starts empty with room for cp
+        bigvector(adopt_storage_t, Allocator const &alloc, size_t cp) : allocator_holder<Allocator>(alloc) {
+            storage_allocator a(this->allocator());
+            auto result = a.adopt();
+            if (!result.ptr) {
+                store = make_storage(cp);
+                store->size_ = 0;
+                return;
             }
+            storage *s = result.ptr;
+            if (result.count == 0 || s->capacity_ > (result.count - 1) * sizeof(storage) / sizeof(T) ||
+                s->size_ > s->capacity_) {
+                storage_traits::deallocate(a, s, result.count);
+                throw std::runtime_error("adopted vector storage is corrupt");
+            }
+            // the count and the hash were left by the previous owner
+            new(&s->ref_count) typename RefCount::counter(1);
+            new(&s->hash_) std::atomic<size_t>(0);
+            store = s;
+        }
+
+        template<typename InputIterator>
+        bigvector(InputIterator beg, InputIterator en, Allocator const &alloc = Allocator())
+                : allocator_holder<Allocator>(alloc) {
+            copy_from(beg, en);
         }
 
-        bigvector(size_t cnt, T const &elem) {
+        bigvector(size_t cnt, T const &elem, Allocator const &alloc = Allocator())
+                : allocator_holder<Allocator>(alloc) {
             if (cnt == 0) {
                 store = nullptr;
             } else {
@@ -75,13 +421,11 @@ struct vector {
                 try {
                     std::uninitialized_fill_n(store->data, cnt, elem);
                 } catch (...) {
-                    operator delete(store);
+                    free_storage(store);
                     store = nullptr;
                     throw;
                 }
                 store->size_ = cnt;
-                store->capacity_ = cnt;
-                store->ref_count = 1;
             }
         }
 
@@ -89,28 +433,26 @@ struct vector {
             if (other.store == store) {
                 return *this;
             }
-            if (store) {
-                std::destroy(begin(), end());
-                operator delete(store);
-            } else {
-                store->ref_count--;
+            bigvector tmp(other, this->allocator());
+            release();
+            store = tmp.store;
+            tmp.store = nullptr;
+            return *this;
+        }
+
+        bigvector &operator=(bigvector &&other) noexcept {
+            if (this == &other) {
+                return *this;
             }
+            release();
+            this->allocator() = other.allocator();
             store = other.store;
-            if (store) {
-                store->ref_count++;
-            }
+            other.store = nullptr;
             return *this;
         }
 
         ~bigvector() {
-            if (store) {
-                if (store->ref_count > 1) {
-                    store->ref_count--;
-                } else {
-                    std::destroy(begin(), end());
-                    operator delete(store);
-                }
-            }
+            release();
         }
 
 
@@ -140,6 +482,7 @@ struct vector {
                 throw std::runtime_error("vector index out of range");
             }
             unique_copy();
+            mark_writable();
             return store->data[index];
         }
 
@@ -153,13 +496,21 @@ struct vector {
         friend bool operator==(bigvector const &a, bigvector const &b) {
             if (a.store == b.store)
                 return true;
-            if (a.store->size_ != b.store->size_)
+            if (a.size() != b.size())
                 return false;
-            return std::equal(a.begin(), a.end(), b.begin(), b.end());
+            if (a.store && b.store) {
+                size_t ha = a.store->hash_.load(std::memory_order_relaxed);
+                size_t hb = b.store->hash_.load(std::memory_order_relaxed);
+                if (ha > hash_writable && hb > hash_writable && ha != hb)
+                    return false;
+            }
+            return vector_simd::equal(a.begin(), b.begin(), a.size());
         }
 
-        friend void swap(bigvector &a, bigvector &b) {
-            std::swap(a.store, b.store);
+        friend void swap(bigvector &a, bigvector &b) noexcept {
+            using std::swap;
+            swap(a.allocator(), b.allocator());
+            swap(a.store, b.store);
         }
 
         // Methods
@@ -193,54 +544,55 @@ struct vector {
 
 
         void push_back(T const &elem) {
-            if (size() == capacity() || store->ref_count > 1) {
+            emplace_back(elem);
+        }
+
+        void push_back(T &&elem) {
+            emplace_back(std::move(elem));
+        }
+
+        template<typename... Args>
+        T &emplace_back(Args &&... args) {
+            if constexpr (reallocates) {
+                if (store && size() == capacity() && !shared()) {
+                    // args may refer to an element the reallocation moves
+                    T elem(std::forward<Args>(args)...);
+                    reserve(std::max(Growth::grow(capacity()), capacity() + 1));
+                    new(store->data + store->size_) T(std::move(elem));
+                    invalidate_hash();
+                    return store->data[store->size_++];
+                }
+            }
+            if (size() == capacity() || shared()) {
                 size_t cap_needed;
                 if (size() == capacity()) {
-                    if (capacity() > 0) {
-                        cap_needed = capacity() * 2;
-                    } else {
-                        cap_needed = 2;
-                    }
+                    cap_needed = std::max(Growth::grow(capacity()), capacity() + 1);
                 } else {
                     cap_needed = capacity();
                 }
+                bool relocate = !shared();
                 storage *tmp = make_storage(cap_needed);
+                // add new first: args may refer to an element we are about to move out
                 try {
-                    std::uninitialized_copy(begin(), end(), tmp->data);
+                    new(tmp->data + size()) T(std::forward<Args>(args)...);
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
-                // add new
                 try {
-                    new(tmp->data + size()) T(elem);
+                    transfer(begin(), end(), tmp->data, relocate);
                 } catch (...) {
-                    std::destroy(tmp->data, tmp->data + size());
-                    operator delete(tmp);
+                    std::destroy_at(tmp->data + size());
+                    free_storage(tmp);
                     throw;
                 }
-                if (!store) {
-                    tmp->size_ = 1;
-                } else {
-                    tmp->size_ = store->size_ + 1;
-                    if (store->ref_count == 1) {
-                        std::destroy(begin(), end());
-                        operator delete(store);
-                    } else {
-                        store->ref_count--;
-                    }
-                }
-                tmp->capacity_ = cap_needed;
-                tmp->ref_count = 1;
-                store = tmp;
-                return;
-            }
-            try {
-                new(store->data + store->size_) T(elem);
-                store->size_++;
-            } catch (...) {
-                throw;
+                tmp->size_ = size() + 1;
+                replace_storage(tmp, relocate);
+                return store->data[store->size_ - 1];
             }
+            new(store->data + store->size_) T(std::forward<Args>(args)...);
+            invalidate_hash();
+            return store->data[store->size_++];
         }
 
         void pop_back() {
@@ -250,6 +602,7 @@ struct vector {
 
         T *data() {
             unique_copy();
+            mark_writable();
             return store ? store->data : nullptr;
         }
 
@@ -261,27 +614,22 @@ struct vector {
             if (cap <= capacity()) {
                 return;
             }
+            if constexpr (reallocates) {
+                if (store && !shared()) {
+                    reallocate_storage(cap);
+                    return;
+                }
+            }
+            bool relocate = !shared();
             storage *tmp = make_storage(cap);
             try {
-                std::uninitialized_copy(begin(), end(), tmp->data);
+                transfer(begin(), end(), tmp->data, relocate);
             } catch (...) {
-                operator delete(tmp);
+                free_storage(tmp);
                 throw;
             }
-            if (!store) {
-                tmp->size_ = 0;
-            } else {
-                tmp->size_ = store->size_;
-                if (store->ref_count == 1) {
-                    std::destroy(begin(), end());
-                    operator delete(store);
-                } else {
-                    store->ref_count--;
-                }
-            }
-            tmp->capacity_ = cap;
-            tmp->ref_count = 1;
-            store = tmp;
+            tmp->size_ = size();
+            replace_storage(tmp, relocate);
         }
 
         void shrink_to_fit() {
@@ -289,102 +637,160 @@ struct vector {
                 return;
             }
             if (size() == 0) {
-                if (store->ref_count == 1) {
-                    std::destroy(begin(), end());
-                    operator delete(store);
-                } else {
-                    store->ref_count--;
-                    store = nullptr;
-                }
+                release();
             } else {
+                if constexpr (reallocates) {
+                    if (!shared()) {
+                        reallocate_storage(store->size_);
+                        return;
+                    }
+                }
+                bool relocate = !shared();
                 storage *tmp = make_storage(store->size_);
                 try {
-                    std::uninitialized_copy(begin(), end(), tmp->data);
+                    transfer(begin(), end(), tmp->data, relocate);
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
-                tmp->capacity_ = store->size_;
                 tmp->size_ = store->size_;
-                tmp->ref_count = 1;
-                if (store->ref_count == 1) {
-                    std::destroy(begin(), end());
-                    operator delete(store);
-                } else {
-                    store->ref_count--;
-                }
-                store = tmp;
+                replace_storage(tmp, relocate);
             }
         }
 
-        void resize(size_t sz, T const &elem) {
+        // fill(dst, n) constructs the n new elements at dst (all or nothing)
+        template<typename Fill>
+        void resize_with(size_t sz, Fill fill) {
             if (sz <= size()) {
                 shorten(sz);
             } else {
-                resize_job(sz, elem);
+                resize_job(sz, fill);
             }
         }
 
+        void resize(size_t sz, T const &elem) {
+            resize_with(sz, [&](T *dst, size_t n) {
+                std::uninitialized_fill_n(dst, n, elem);
+            });
+        }
+
         void clear() {
-            resize(0);
+            shorten(0);
         }
 
         T *insert(T const *pos, T const &elem) {
+            return emplace(pos, elem);
+        }
+
+        T *insert(T const *pos, T &&elem) {
+            return emplace(pos, std::move(elem));
+        }
+
+        template<typename... Args>
+        T *emplace(T const *pos, Args &&... args) {
             size_t index = pos - begin();
             if (const_cast<T *>(pos) == end()) {
-                push_back(elem);
+                emplace_back(std::forward<Args>(args)...);
                 return begin() + index;
             }
-            if (size() == capacity() || store->ref_count > 1) {
+            if constexpr (reallocates) {
+                if (size() == capacity() && !shared()) {
+                    T elem(std::forward<Args>(args)...);
+                    reserve(std::max(Growth::grow(capacity()), capacity() + 1));
+                    return emplace(begin() + index, std::move(elem));
+                }
+            }
+            if (size() == capacity() || shared()) {
                 size_t cap_needed;
                 if (size() == capacity()) {
-                    if (capacity() > 0) {
-                        cap_needed = capacity() * 2;
-                    } else {
-                        cap_needed = 2;
-                    }
+                    cap_needed = std::max(Growth::grow(capacity()), capacity() + 1);
                 } else {
                     cap_needed = capacity();
                 }
+                bool relocate = !shared();
                 storage *tmp = make_storage(cap_needed);
                 try {
-                    std::uninitialized_copy(begin(), const_cast<T *>(pos), tmp->data);
+                    new(tmp->data + index) T(std::forward<Args>(args)...);
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
                 try {
-                    new(tmp->data + index) T(elem);
+                    transfer(begin(), begin() + index, tmp->data, relocate);
                 } catch (...) {
-                    std::destroy(tmp->data, tmp->data + index);
-                    operator delete(tmp);
+                    std::destroy_at(tmp->data + index);
+                    free_storage(tmp);
                     throw;
                 }
                 try {
-                    std::uninitialized_copy(const_cast<T *>(pos), end(), tmp->data + index + 1);
+                    transfer(begin() + index, end(), tmp->data + index + 1, relocate);
                 } catch (...) {
                     std::destroy(tmp->data, tmp->data + index + 1);
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
                 tmp->size_ = store->size_ + 1;
-                tmp->capacity_ = cap_needed;
-                tmp->ref_count = 1;
-                if (store->ref_count == 1) {
-                    std::destroy(begin(), end());
-                    operator delete(store);
-                } else {
-                    store->ref_count--;
-                }
-                store = tmp;
+                replace_storage(tmp, relocate);
                 return begin() + index;
             }
-            std::uninitialized_copy(&elem, (&elem) + 1, end());
+            new(end()) T(std::forward<Args>(args)...);
             store->size_++;
+            invalidate_hash();
             std::rotate(begin() + index, end() - 1, end());
             return begin() + index;
         }
 
+        // Inserts n elements that construct(dst) builds at dst (all or nothing), with at most one
+        // allocation; construct may read from our current elements unless we have to grow
+        template<typename Construct>
+        T *insert_n(T const *pos, size_t n, Construct construct) {
+            size_t index = pos - begin();
+            if (n == 0) {
+                return begin() + index;
+            }
+            if constexpr (reallocates) {
+                if (store && size() + n > capacity() && !shared()) {
+                    reserve(std::max(Growth::grow(capacity()), size() + n));
+                }
+            }
+            if (size() + n > capacity() || shared()) {
+                size_t cap_needed = capacity();
+                if (size() + n > capacity()) {
+                    cap_needed = std::max(Growth::grow(capacity()), size() + n);
+                }
+                bool relocate = !shared();
+                storage *tmp = make_storage(cap_needed);
+                try {
+                    construct(tmp->data + index);
+                } catch (...) {
+                    free_storage(tmp);
+                    throw;
+                }
+                try {
+                    transfer(begin(), begin() + index, tmp->data, relocate);
+                } catch (...) {
+                    std::destroy(tmp->data + index, tmp->data + index + n);
+                    free_storage(tmp);
+                    throw;
+                }
+                try {
+                    transfer(begin() + index, end(), tmp->data + index + n, relocate);
+                } catch (...) {
+                    std::destroy(tmp->data, tmp->data + index + n);
+                    free_storage(tmp);
+                    throw;
+                }
+                tmp->size_ = store->size_ + n;
+                replace_storage(tmp, relocate);
+                return begin() + index;
+            }
+            construct(end());
+            store->size_ += n;
+            invalidate_hash();
+            std::rotate(begin() + index, end() - n, end());
+            return begin() + index;
+        }
+
         T *erase(T const *beg, T const *en) {
             if (beg == en) {
                 return begin() + (beg - begin());
@@ -397,44 +803,150 @@ struct vector {
                 store->size_ -= (right - left);
                 return begin() + left;
             }
-            if (store->ref_count > 1) {
+            if (shared()) {
                 storage *tmp = make_storage(store->capacity_);
                 try {
-                    std::uninitialized_copy(begin(), const_cast<T *>(beg), tmp->data);
+                    std::uninitialized_copy(begin(), begin() + left, tmp->data);
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
+                    throw;
                 }
                 try {
-                    std::uninitialized_copy(const_cast<T *>(en), end(), store->data + left);
+                    std::uninitialized_copy(begin() + right, end(), tmp->data + left);
                 } catch (...) {
                     std::destroy(tmp->data, tmp->data + left);
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
                 tmp->size_ = store->size_ - right + left;
-                tmp->capacity_ = store->capacity_;
-                tmp->ref_count = 1;
-                if (store->ref_count == 1) {
-                    std::destroy(begin(), end());
-                } else {
-                    store->ref_count--;
-                }
+                stats::on_detach(tmp->size_ * sizeof(T));
+                stats::on_copy(tmp->size_);
+                drop(store);
                 store = tmp;
                 return begin() + left;
             }
+            invalidate_hash();
             std::move(begin() + right, end(), begin() + left);
             std::destroy(begin() + size() - right + left, end());
             store->size_ -= (right - left);
             return begin() + left;
         }
 
+        // Removes the elements remove(index, elem) picks, asking once per element in order.
+        // Shared storage is left to its other owners: the kept elements are copied out in the same pass.
+        template<typename Remove>
+        size_t erase_where(Remove &remove) {
+            size_t n = size();
+            size_t first = 0;
+            while (first != n && !remove(first, std::as_const(store->data[first]))) {
+                ++first;
+            }
+            if (first == n) {
+                return 0;
+            }
+            if (!shared()) {
+                invalidate_hash();
+                compact(store->data, first, n, remove, [this](size_t sz) {
+                    store->size_ = sz;
+                });
+                return n - store->size_;
+            }
+            storage *tmp = make_storage(store->capacity_);
+            size_t kept = 0;
+            try {
+                std::uninitialized_copy(begin(), begin() + first, tmp->data);
+                kept = first;
+                for (size_t i = first + 1; i != n; ++i) {
+                    T const &elem = store->data[i];
+                    if (!remove(i, elem)) {
+                        new(tmp->data + kept) T(elem);
+                        ++kept;
+                    }
+                }
+            } catch (...) {
+                std::destroy(tmp->data, tmp->data + kept);
+                free_storage(tmp);
+                throw;
+            }
+            tmp->size_ = kept;
+            stats::on_detach(kept * sizeof(T));
+            stats::on_copy(kept);
+            drop(store);
+            store = tmp;
+            return n - kept;
+        }
+
 
     private:
+        // We must not hold storage yet
+        template<typename InputIterator>
+        void copy_from(InputIterator beg, InputIterator en) {
+            ptrdiff_t len = std::distance(beg, en);
+            if (len <= 0) {
+                return;
+            }
+            storage *tmp = make_storage((size_t) len);
+            try {
+                std::uninitialized_copy(beg, en, tmp->data);
+            } catch (...) {
+                free_storage(tmp);
+                throw;
+            }
+            tmp->size_ = (size_t) len;
+            store = tmp;
+        }
+
+        // Constructs [first, last) of our storage at dst. Exclusively owned elements
+        // (relocate == !shared(), sampled once) are moved or memcpy'd, shared ones are copied.
+        void transfer(T *first, T *last, T *dst, bool relocate) {
+            if (first == last) {
+                return;
+            }
+            if (!relocate || !(is_trivially_relocatable<T>::value || std::is_nothrow_move_constructible_v<T> ||
+                               !std::is_copy_constructible_v<T>)) {
+                stats::on_copy(last - first);
+            } else {
+                stats::on_move(last - first);
+            }
+            if (!relocate) {
+                std::uninitialized_copy(first, last, dst);
+            } else if constexpr (is_trivially_relocatable<T>::value) {
+                std::memcpy(static_cast<void *>(dst), static_cast<void const *>(first), sizeof(T) * (last - first));
+            } else if constexpr (std::is_nothrow_move_constructible_v<T> || !std::is_copy_constructible_v<T>) {
+                std::uninitialized_move(first, last, dst);
+            } else {
+                std::uninitialized_copy(first, last, dst);
+            }
+        }
+
+        // Switches to tmp after transfer() has filled it with our elements
+        void replace_storage(storage *tmp, bool relocate) noexcept {
+            if (store && !relocate) {
+                stats::on_detach(store->size_ * sizeof(T));
+                drop(store);
+            } else if (store) {
+                stats::on_reallocate();
+                if constexpr (!is_trivially_relocatable<T>::value) {
+                    std::destroy(begin(), end());
+                }
+                free_storage(store);
+            }
+            store = tmp;
+        }
+
+        void release() noexcept {
+            if (store) {
+                drop(store);
+                store = nullptr;
+            }
+        }
+
         void shorten(size_t sz) {
             if (sz == size()) {
                 return;
             }
-            if (store->ref_count == 1) {
+            if (!shared()) {
+                invalidate_hash();
                 std::destroy(begin() + sz, end());
                 store->size_ = sz;
             } else {
@@ -442,175 +954,328 @@ struct vector {
                 try {
                     std::uninitialized_copy(begin(), begin() + sz, tmp->data);
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
                 tmp->size_ = sz;
-                tmp->capacity_ = store->capacity_;
-                tmp->ref_count = 1;
-                store->ref_count--;
+                stats::on_detach(sz * sizeof(T));
+                stats::on_copy(sz);
+                drop(store);
                 store = tmp;
             }
         }
 
-        void resize_job(size_t sz, T const &elem) {
+        // fill may read from our current elements unless we have to grow
+        template<typename Fill>
+        void resize_job(size_t sz, Fill fill) {
+            if constexpr (reallocates) {
+                if (store && !shared()) {
+                    reserve(sz);
+                }
+            }
             size_t new_cap = std::max(capacity(), sz);
-            if (!store || new_cap > capacity() || store->ref_count > 1) {
+            if (!store || new_cap > capacity() || shared()) {
+                bool relocate = !shared();
                 storage *tmp = make_storage(new_cap);
+                // fill first: it may read an element we are about to move out
                 try {
-                    std::uninitialized_copy(begin(), end(), tmp->data);
+                    fill(tmp->data + size(), sz - size());
                 } catch (...) {
-                    operator delete(tmp);
+                    free_storage(tmp);
                     throw;
                 }
                 try {
-                    std::fill_n(tmp->data + size(), sz - size(), elem);
+                    transfer(begin(), end(), tmp->data, relocate);
                 } catch (...) {
-                    std::destroy(tmp->data, tmp->data + size());
-                    operator delete(tmp);
+                    std::destroy(tmp->data + size(), tmp->data + sz);
+                    free_storage(tmp);
+                    throw;
                 }
                 tmp->size_ = sz;
-                tmp->capacity_ = new_cap;
-                tmp->ref_count = 1;
-                if (store) {
-                    if (store->ref_count == 1) {
-                        std::destroy(begin(), end());
-                        operator delete(store);
-                    } else {
-                        store->ref_count--;
-                    }
-                }
-                store = tmp;
+                replace_storage(tmp, relocate);
                 return;
             }
-            std::fill_n(begin() + size(), sz - size(), elem);
+            fill(begin() + size(), sz - size());
             store->size_ = sz;
+            invalidate_hash();
         }
     };  //  BIGVECTOR
 
     // VECTOR:
 private:
-    std::variant<std::monostate, T, bigvector> vec_data;
+    friend struct vector_slice<vector>;
+
+    struct small_rep : allocator_holder<Allocator> {
+        using allocator_holder<Allocator>::allocator_holder;
+
+        alignas(T) unsigned char buf[sizeof(T) * SmallSize];
+    };
+
+    typedef std::allocator_traits<Allocator> alloc_traits;
+
+    // Low bit set: big_ is active and its store is never null.
+    // Otherwise small_ is active and its first (tag_ >> 1) elements are alive.
+    // size(), capacity() and const data() test that bit before their one load,
+    // so the heap path is one well-predicted branch rather than branch-free.
+    size_t tag_;
+    union {
+        bigvector big_;
+        small_rep small_;
+    };
 
 public:
     typedef T value_type;
+    typedef Allocator allocator_type;
     typedef T *iterator;
     typedef T const *const_iterator;
     typedef std::reverse_iterator<iterator> reverse_iterator;
     typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
 
-    vector() noexcept = default;
+    static constexpr size_t small_size = SmallSize;
+
+    vector() noexcept(std::is_nothrow_default_constructible_v<Allocator>) : tag_(0), small_() {}
+
+    explicit vector(Allocator const &alloc) noexcept : tag_(0), small_(alloc) {}
+
+    // Continues with the storage a persistent allocator (see mapped_file_allocator.h)
+    // kept from an earlier owner, or starts empty in new storage of that allocator
+    vector(adopt_storage_t, Allocator const &alloc) : tag_(0) {
+        static_assert(has_adopt<Allocator>::value, "the allocator cannot hand back earlier storage");
+        new(&big_) bigvector(adopt_storage, alloc, Growth::grow(SmallSize));
+        tag_ = 1;
+    }
+
+    vector(vector const &other)
+            : vector(other, alloc_traits::select_on_container_copy_construction(other.get_allocator())) {}
+
+    vector(vector const &other, Allocator const &alloc) : tag_(0) {
+        if (other.is_big()) {
+            new(&big_) bigvector(other.big_, alloc);
+        } else {
+            new(&small_) small_rep(alloc);
+            try {
+                std::uninitialized_copy(other.small_begin(), other.small_end(), small_begin());
+            } catch (...) {
+                small_.~small_rep();
+                throw;
+            }
+        }
+        tag_ = other.tag_;
+    }
+
+    vector(vector &&other) noexcept(std::is_nothrow_move_constructible_v<T>) : tag_(0) {
+        steal(other);
+    }
+
+    vector &operator=(vector const &other) {
+        if (this != &other) {
+            vector tmp(other, alloc_traits::propagate_on_container_copy_assignment::value ? other.get_allocator()
+                                                                                         : get_allocator());
+            destroy_all();
+            steal(tmp);
+        }
+        return *this;
+    }
 
-    vector(vector const &other) = default;
+    vector &operator=(vector &&other) noexcept(std::is_nothrow_move_constructible_v<T> &&
+                                              (alloc_traits::propagate_on_container_move_assignment::value ||
+                                               alloc_traits::is_always_equal::value)) {
+        if (this == &other) {
+            return *this;
+        }
+        if (alloc_traits::propagate_on_container_move_assignment::value || get_allocator() == other.get_allocator()) {
+            destroy_all();
+            steal(other);
+        } else {
+            // our allocator cannot free other's storage, so only the elements move over
+            vector tmp(std::make_move_iterator(other.begin()), std::make_move_iterator(other.end()), get_allocator());
+            destroy_all();
+            steal(tmp);
+            other.clear();
+        }
+        return *this;
+    }
 
-    vector &operator=(vector const &other) = default;
+    ~vector() {
+        destroy_all();
+    }
 
-    template<typename InputIterator>
-    vector(InputIterator beg, InputIterator en) {
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    vector(InputIterator beg, InputIterator en, Allocator const &alloc = Allocator()) : tag_(0) {
+        if constexpr (!is_forward_iterator<InputIterator>) {
+            new(&small_) small_rep(alloc);
+            try {
+                for (; beg != en; ++beg) {
+                    emplace_back(*beg);
+                }
+            } catch (...) {
+                destroy_all();
+                throw;
+            }
+            return;
+        }
         ptrdiff_t len = std::distance(beg, en);
-        if (len > 1) {
-            vec_data = bigvector(beg, en);
-        } else if (len == 1) {
-            vec_data = T(*beg);
+        if (len > (ptrdiff_t) SmallSize) {
+            new(&big_) bigvector(beg, en, alloc);
+            tag_ = 1;
+            return;
+        }
+        new(&small_) small_rep(alloc);
+        if (len > 0) {
+            try {
+                std::uninitialized_copy(beg, en, small_begin());
+            } catch (...) {
+                small_.~small_rep();
+                throw;
+            }
+            tag_ = (size_t) len << 1;
         }
     }
 
-    template<typename InputIterator>
+    vector(size_t cnt, T const &elem, Allocator const &alloc = Allocator()) : vector(alloc) {
+        resize(cnt, elem);
+    }
+
+    vector(std::initializer_list<T> init, Allocator const &alloc = Allocator())
+            : vector(init.begin(), init.end(), alloc) {}
+
+    vector &operator=(std::initializer_list<T> init) {
+        assign(init.begin(), init.end());
+        return *this;
+    }
+
+    allocator_type get_allocator() const noexcept {
+        return is_big() ? big_.allocator() : small_.allocator();
+    }
+
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
     void assign(InputIterator beg, InputIterator en) {
-        *this = vector(beg, en);
+        *this = vector(beg, en, get_allocator());
+    }
+
+    void assign(std::initializer_list<T> init) {
+        assign(init.begin(), init.end());
     }
 
     T &operator[](size_t index) {
-        if (vec_data.index() == 1) {
-            return std::get<1>(vec_data);
-        }
-        return std::get<2>(vec_data)[index];
+        return is_big() ? big_[index] : small_begin()[index];
     }
 
     T const &operator[](size_t index) const {
-        if (vec_data.index() == 1) {
-            return std::get<1>(vec_data);
+        return is_big() ? big_[index] : small_begin()[index];
+    }
+
+    // No bounds check and no copy-on-write, even on a non-const vector
+    T const &unchecked_at(size_t index) const noexcept {
+        return data()[index];
+    }
+
+    T &checked_at(size_t index) {
+        if (index >= size()) {
+            throw std::runtime_error("vector index out of range");
         }
-        return std::get<2>(vec_data)[index];
+        return data()[index];
+    }
+
+    T const &checked_at(size_t index) const {
+        if (index >= size()) {
+            throw std::runtime_error("vector index out of range");
+        }
+        return data()[index];
     }
 
     T &front() {
-        return (vec_data.index() == 1) ? (std::get<1>(vec_data)) : (std::get<2>(vec_data).front());
+        return is_big() ? big_.front() : *small_begin();
     }
 
     T const &front() const {
-        return (vec_data.index() == 1) ? (std::get<1>(vec_data)) : (std::get<2>(vec_data).front());
+        return is_big() ? big_.front() : *small_begin();
     }
 
     T &back() {
-        return (vec_data.index() == 1) ? (std::get<1>(vec_data)) : (std::get<2>(vec_data).back());
+        return is_big() ? big_.back() : small_end()[-1];
     }
 
     T const &back() const {
-        return (vec_data.index() == 1) ? (std::get<1>(vec_data)) : (std::get<2>(vec_data).back());
+        return is_big() ? big_.back() : small_end()[-1];
     }
 
     size_t size() const noexcept {
-        if (vec_data.index() == 0) {
-            return 0;
-        } else if (vec_data.index() == 1) {
-            return 1;
-        }
-        return std::get<2>(vec_data).size();
+        return is_big() ? big_.store->size_ : (tag_ >> 1);
     }
 
     size_t capacity() const noexcept {
-        if (vec_data.index() == 0) {
-            return 0;
-        } else if (vec_data.index() == 1) {
-            return 1;
-        }
-        return std::get<2>(vec_data).capacity();
+        return is_big() ? big_.store->capacity_ : SmallSize;
     }
 
     void push_back(T const &elem) {
-        if (vec_data.index() == 0) {
-            vec_data = T(elem);
-        } else if (vec_data.index() == 1) {
-            bigvector tmp;
-            tmp.push_back(std::get<1>(vec_data));
-            tmp.push_back(elem);
-            vec_data = tmp;
-        } else {
-            std::get<2>(vec_data).push_back(elem);
+        emplace_back(elem);
+    }
+
+    void push_back(T &&elem) {
+        emplace_back(std::move(elem));
+    }
+
+    template<typename... Args>
+    T &emplace_back(Args &&... args) {
+        if (is_big()) {
+            return big_.emplace_back(std::forward<Args>(args)...);
         }
+        size_t sz = tag_ >> 1;
+        if (sz < SmallSize) {
+            new(small_begin() + sz) T(std::forward<Args>(args)...);
+            tag_ += 2;
+            return small_begin()[sz];
+        }
+        // args may refer to an inline element, so build the new one before moving them out
+        T elem(std::forward<Args>(args)...);
+        spill(Growth::grow(SmallSize));
+        return big_.emplace_back(std::move(elem));
     }
 
     void pop_back() {
-        if (vec_data.index() == 0) {
+        if (is_big()) {
+            big_.pop_back();
+            return;
+        }
+        if (tag_ == 0) {
             throw std::runtime_error("attempt to pop_back in empty vector");
-        } else if (vec_data.index() == 1) {
-            vec_data = std::monostate();
-        } else {
-            std::get<2>(vec_data).pop_back();
         }
+        tag_ -= 2;
+        std::destroy_at(small_end());
     }
 
     T *data() {
-        switch (vec_data.index()) {
-            case 0:
-                return nullptr;
-            case 1:
-                return &std::get<1>(vec_data);
-            default:
-                return std::get<2>(vec_data).data();
-        }
+        return is_big() ? big_.data() : small_begin();
     }
 
     T const *data() const noexcept {
-        switch (vec_data.index()) {
-            case 0:
-                return nullptr;
-            case 1:
-                return &std::get<1>(vec_data);
-            default:
-                return std::get<2>(vec_data).data();
+        return is_big() ? big_.store->data : small_begin();
+    }
+
+    // Detaches shared storage once; writes through the span need no further checks
+    span<T> mutable_span() {
+        T *ptr = data();
+        return span<T>(ptr, size());
+    }
+
+    span<T const> const_span() const noexcept {
+        return span<T const>(data(), size());
+    }
+
+    // True while another vector holds our heap storage: the next write copies it
+    bool shared() const noexcept {
+        return is_big() && big_.shared();
+    }
+
+    typedef vector_slice<vector> slice_type;
+
+    // Elements [first, last) sharing our heap storage, copied only when the slice is written to
+    slice_type slice(size_t first, size_t last) const {
+        if (first > last || last > size()) {
+            throw std::runtime_error("vector slice out of range");
         }
+        return slice_type(*this, first, last - first);
     }
 
     iterator begin() {
@@ -649,52 +1314,156 @@ public:
         return size() == 0;
     }
 
+    // First element equal to value, end() if there is none; vectorized for trivially comparable T
+    const_iterator find(T const &value) const {
+        return begin() + vector_simd::find(data(), size(), value);
+    }
+
+    size_t count(T const &value) const {
+        return vector_simd::count(data(), size(), value);
+    }
+
+    // Equal vectors hash equally whether inline or not; heap storage keeps the result until the next write
+    size_t hash() const {
+        return is_big() ? big_.hash() : bigvector::hash_elements(small_begin(), small_end());
+    }
+
     void reserve(size_t cap) {
-        bigvector tmp;
-        switch (vec_data.index()) {
-            case 0:
-                if (cap == 0) return;
-                break;
-            case 1:
-                if (cap < 1) return;
-                tmp.push_back(std::get<1>(vec_data));
-                break;
-            default:
-                std::get<2>(vec_data).reserve(cap);
-                return;
+        if (is_big()) {
+            big_.reserve(cap);
+        } else if (cap > SmallSize) {
+            spill(cap);
         }
-        tmp.reserve(cap);
-        vec_data = tmp;
     }
 
+    // Storage of persistent allocators stays where it is, even when it would fit inline
     void shrink_to_fit() {
-        if (vec_data.index() != 2)
+        if (!is_big())
             return;
-        std::get<2>(vec_data).shrink_to_fit();
+        if (big_.size() > SmallSize || (has_adopt<Allocator>::value && big_.size() > 0)) {
+            big_.shrink_to_fit();
+        } else if constexpr (!has_adopt<Allocator>::value) {
+            unspill();
+        }
     }
 
     void resize(size_t sz) {
-        resize_job(sz, T());
+        resize_job(sz, [](T *dst, size_t n) {
+            std::uninitialized_value_construct_n(dst, n);
+        });
     }
 
     void resize(size_t sz, T const &elem) {
-        resize_job(sz, elem);
+        if (sz > capacity()) {
+            // elem may be one of our elements, which growing moves out
+            T value(elem);
+            resize_job(sz, [&](T *dst, size_t n) {
+                std::uninitialized_fill_n(dst, n, value);
+            });
+        } else {
+            resize_job(sz, [&](T *dst, size_t n) {
+                std::uninitialized_fill_n(dst, n, elem);
+            });
+        }
+    }
+
+    // Like resize(), but new elements are default-initialized: trivial T is left unwritten
+    void resize_for_overwrite(size_t sz) {
+        resize_job(sz, [](T *dst, size_t n) {
+            std::uninitialized_default_construct_n(dst, n);
+        });
+    }
+
+    // Hands write(dst, n) uninitialized room for n elements after end() and keeps
+    // the first k of them, where k is what write returns (at most n)
+    template<typename Write>
+    size_t reserve_and_write(size_t n, Write write) {
+        static_assert(std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>,
+                      "reserve_and_write hands out raw memory, T must be trivial");
+        size_t old_size = size();
+        if (old_size + n > capacity()) {
+            reserve(std::max(Growth::grow(capacity()), old_size + n));
+        }
+        resize_for_overwrite(old_size + n);
+        size_t written;
+        try {
+            written = std::min<size_t>(write(data() + old_size, n), n);
+        } catch (...) {
+            resize_for_overwrite(old_size);
+            throw;
+        }
+        resize_for_overwrite(old_size + written);
+        return written;
     }
 
     iterator insert(const_iterator pos, T const &val) {
-        bigvector tmp;
-        size_t index = const_cast<iterator> (pos) - begin();
-        if (vec_data.index() == 0) {
-            vec_data = T(val);
-            return begin();
-        }
-        if (vec_data.index() == 1) {
-            tmp.push_back(std::get<1>(vec_data));
-            tmp.insert(tmp.begin() + index, val);
-            vec_data = tmp;
+        return emplace(pos, val);
+    }
+
+    iterator insert(const_iterator pos, T &&val) {
+        return emplace(pos, std::move(val));
+    }
+
+    template<typename... Args>
+    iterator emplace(const_iterator pos, Args &&... args) {
+        if (is_big()) {
+            return big_.emplace(pos, std::forward<Args>(args)...);
+        }
+        size_t index = pos - small_begin();
+        if ((tag_ >> 1) < SmallSize) {
+            new(small_end()) T(std::forward<Args>(args)...);
+            tag_ += 2;
+            std::rotate(small_begin() + index, small_end() - 1, small_end());
+            return small_begin() + index;
+        }
+        T elem(std::forward<Args>(args)...);
+        spill(Growth::grow(SmallSize));
+        return big_.insert(big_.begin() + index, std::move(elem));
+    }
+
+    iterator insert(const_iterator pos, size_t cnt, T const &val) {
+        if (cnt == 0) {
+            return begin() + (pos - std::as_const(*this).begin());
+        }
+        size_t index = pos - std::as_const(*this).begin();
+        if (size() + cnt > capacity()) {
+            // val may be one of our elements, which growing moves out
+            T value(val);
+            return insert_n(index, cnt, [&](T *dst) {
+                std::uninitialized_fill_n(dst, cnt, value);
+            });
+        }
+        return insert_n(index, cnt, [&](T *dst) {
+            std::uninitialized_fill_n(dst, cnt, val);
+        });
+    }
+
+    // [beg, en) must not point into this vector
+    template<typename InputIterator, typename = iterator_category_t<InputIterator>>
+    iterator insert(const_iterator pos, InputIterator beg, InputIterator en) {
+        size_t index = pos - std::as_const(*this).begin();
+        if constexpr (!is_forward_iterator<InputIterator>) {
+            size_t old_size = size();
+            for (; beg != en; ++beg) {
+                emplace_back(*beg);
+            }
+            std::rotate(begin() + index, begin() + old_size, end());
             return begin() + index;
+        } else {
+            size_t cnt = std::distance(beg, en);
+            return insert_n(index, cnt, [&](T *dst) {
+                std::uninitialized_copy(beg, en, dst);
+            });
         }
-        return std::get<2>(vec_data).insert(pos, val);
+    }
+
+    iterator insert(const_iterator pos, std::initializer_list<T> init) {
+        return insert(pos, init.begin(), init.end());
+    }
+
+    template<typename Range>
+    void append_range(Range &&range) {
+        insert(end(), std::begin(range), std::end(range));
     }
 
     iterator erase(const_iterator ind) {
@@ -703,28 +1472,74 @@ public:
 
     iterator erase(const_iterator beg, const_iterator en) {
         if (beg == en) {
-            return begin() + (beg - begin());
+            return begin() + (beg - std::as_const(*this).begin());
+        }
+        if (is_big()) {
+            return big_.erase(beg, en);
+        }
+        size_t left = beg - small_begin();
+        size_t right = en - small_begin();
+        std::move(small_begin() + right, small_end(), small_begin() + left);
+        std::destroy(small_end() - (right - left), small_end());
+        tag_ -= (right - left) << 1;
+        return small_begin() + left;
+    }
+
+    // Removes the elements at indices, which must be ascending and within the vector,
+    // in one pass that detaches shared storage at most once
+    template<typename Indices>
+    size_t remove_indices(Indices const &indices) {
+        auto it = std::begin(indices);
+        auto en = std::end(indices);
+        for (auto i = it, prev = it; i != en; prev = i, ++i) {
+            if ((size_t) *i >= size() || (i != it && *i <= *prev)) {
+                throw std::runtime_error("remove_indices needs ascending indices within the vector");
+            }
         }
-        if (vec_data.index() == 1) {
-            vec_data = std::monostate();
-            return begin();
+        auto remove = [&it, &en](size_t index, T const &) {
+            if (it != en && (size_t) *it == index) {
+                ++it;
+                return true;
+            }
+            return false;
+        };
+        return erase_where(remove);
+    }
+
+    // O(1) erase that moves the last element into pos, so the order is not kept
+    iterator swap_erase(const_iterator pos) {
+        size_t index = pos - std::as_const(*this).data();
+        T *first = data();
+        if (index + 1 != size()) {
+            first[index] = std::move(first[size() - 1]);
         }
-        return std::get<2>(vec_data).erase(beg, en);
+        pop_back();
+        return first + index;
+    }
+
+    // Removes the elements pred accepts in one compacting pass, calling it once per element in order
+    template<typename Pred>
+    friend size_t erase_if(vector &v, Pred pred) {
+        auto remove = [&pred](size_t, T const &elem) {
+            return static_cast<bool>(pred(elem));
+        };
+        return v.erase_where(remove);
     }
 
     void clear() {
-        if (vec_data.index() != 2) {
-            vec_data = std::monostate();
+        if (is_big()) {
+            big_.clear();
         } else {
-            std::get<2>(vec_data).clear();
+            std::destroy(small_begin(), small_end());
+            tag_ = 0;
         }
     }
 
     friend bool operator==(vector const &a, vector const &b) {
-        if (a.vec_data.index() == 2 && b.vec_data.index() == 2) {
-            return std::get<2>(a.vec_data) == std::get<2>(b.vec_data);
+        if (a.is_big() && b.is_big()) {
+            return a.big_ == b.big_;
         }
-        return std::equal(a.begin(), a.end(), b.begin(), b.end());
+        return a.size() == b.size() && vector_simd::equal(a.data(), b.data(), a.size());
     }
 
     friend bool operator!=(vector const &a, vector const &b) {
@@ -732,7 +1547,7 @@ public:
     }
 
     friend bool operator<(vector const &a, vector const &b) {
-        return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+        return vector_simd::lexicographical_less(a.data(), a.size(), b.data(), b.size());
     }
 
     friend bool operator>(vector const &a, vector const &b) {
@@ -748,35 +1563,312 @@ public:
     }
 
     friend void swap(vector &a, vector &b) {
-        std::swap(a.vec_data, b.vec_data);
+        if (&a == &b) {
+            return;
+        }
+        if (a.is_big() && b.is_big()) {
+            swap(a.big_, b.big_);
+            return;
+        }
+        vector tmp(std::move(a));
+        a = std::move(b);
+        b = std::move(tmp);
     }
 
 private:
-    void resize_job(size_t sz, T const &elem) {
-        bigvector tmp;
-        switch (vec_data.index()) {
-            case 0:
-                if (sz == 0) return;
-                if (sz == 1) {
-                    vec_data = elem;
-                    return;
+    bool is_big() const noexcept {
+        return tag_ & 1;
+    }
+
+    T *small_begin() noexcept {
+        return std::launder(reinterpret_cast<T *>(small_.buf));
+    }
+
+    T const *small_begin() const noexcept {
+        return std::launder(reinterpret_cast<T const *>(small_.buf));
+    }
+
+    T *small_end() noexcept {
+        return small_begin() + (tag_ >> 1);
+    }
+
+    T const *small_end() const noexcept {
+        return small_begin() + (tag_ >> 1);
+    }
+
+    // Moves the elements of [first, n) that remove() keeps over those it drops, where the
+    // element at first is known to go, and destroys the leftovers. set_size(m) receives the
+    // new size even if remove throws; the elements it has not looked at are kept then,
+    // unless moving them down throws too.
+    template<typename Remove, typename SetSize>
+    static void compact(T *data, size_t first, size_t n, Remove &remove, SetSize set_size) {
+        size_t write = first;
+        size_t read = first + 1;
+        try {
+            for (; read != n; ++read) {
+                if (!remove(read, std::as_const(data[read]))) {
+                    // write only moves on once the element is in place, so a throwing
+                    // assignment leaves no stale slot behind
+                    data[write] = std::move(data[read]);
+                    ++write;
                 }
-                break;
-            case 1:
-                if (sz == 0) {
-                    vec_data = std::monostate();
-                    return;
+            }
+        } catch (...) {
+            // a move that throws while shifting the rest down drops what is left,
+            // so the kept prefix never holds a slot twice
+            try {
+                for (; read != n; ++read, ++write) {
+                    data[write] = std::move(data[read]);
                 }
-                if (sz == 1) {
-                    return;
+            } catch (...) {
+                std::destroy(data + write, data + n);
+                set_size(write);
+                throw;
+            }
+            std::destroy(data + write, data + n);
+            set_size(write);
+            throw;
+        }
+        std::destroy(data + write, data + n);
+        set_size(write);
+    }
+
+    template<typename Remove>
+    size_t erase_where(Remove &remove) {
+        if (is_big()) {
+            return big_.erase_where(remove);
+        }
+        size_t n = size();
+        size_t first = 0;
+        while (first != n && !remove(first, std::as_const(small_begin()[first]))) {
+            ++first;
+        }
+        if (first == n) {
+            return 0;
+        }
+        compact(small_begin(), first, n, remove, [this](size_t sz) {
+            tag_ = sz << 1;
+        });
+        return n - size();
+    }
+
+    // Ends the lifetime of the active member; only steal() may follow
+    void destroy_all() noexcept {
+        if (is_big()) {
+            big_.~bigvector();
+        } else {
+            std::destroy(small_begin(), small_end());
+            small_.~small_rep();
+        }
+        tag_ = 0;
+    }
+
+    // Takes other's elements and allocator, leaving it empty; nothing of ours may be alive
+    void steal(vector &other) {
+        Allocator alloc = other.get_allocator();
+        if (other.is_big()) {
+            new(&big_) bigvector(std::move(other.big_));
+        } else {
+            new(&small_) small_rep(alloc);
+            try {
+                std::uninitialized_move(other.small_begin(), other.small_end(), small_begin());
+            } catch (...) {
+                tag_ = 0;
+                throw;
+            }
+        }
+        tag_ = other.tag_;
+        other.destroy_all();
+        new(&other.small_) small_rep(alloc);
+    }
+
+    template<typename Construct>
+    iterator insert_n(size_t index, size_t cnt, Construct construct) {
+        if (is_big()) {
+            return big_.insert_n(big_.begin() + index, cnt, construct);
+        }
+        size_t old_size = tag_ >> 1;
+        if (old_size + cnt <= SmallSize) {
+            construct(small_end());
+            tag_ += cnt << 1;
+            std::rotate(small_begin() + index, small_begin() + old_size, small_end());
+            return small_begin() + index;
+        }
+        spill(std::max(Growth::grow(SmallSize), old_size + cnt));
+        return big_.insert_n(big_.begin() + index, cnt, construct);
+    }
+
+    // Moves the inline elements into a heap block of at least cap elements
+    void spill(size_t cap) {
+        bigvector tmp(small_.allocator());
+        tmp.reserve(std::max(cap, tag_ >> 1));
+        stats::on_reallocate();
+        if constexpr (std::is_nothrow_move_constructible_v<T> || !std::is_copy_constructible_v<T>) {
+            stats::on_move(tag_ >> 1);
+        } else {
+            stats::on_copy(tag_ >> 1);
+        }
+        for (T *it = small_begin(); it != small_end(); ++it) {
+            tmp.push_back(std::move_if_noexcept(*it));
+        }
+        std::destroy(small_begin(), small_end());
+        small_.~small_rep();
+        new(&big_) bigvector(std::move(tmp));
+        tag_ = 1;
+    }
+
+    // Brings a heap vector of at most SmallSize elements back inline
+    void unspill() {
+        bigvector tmp(std::move(big_));
+        big_.~bigvector();
+        new(&small_) small_rep(tmp.allocator());
+        tag_ = 0;
+        try {
+            if (!tmp.shared()) {
+                if constexpr (std::is_nothrow_move_constructible_v<T> || !std::is_copy_constructible_v<T>) {
+                    stats::on_move(tmp.size());
+                    std::uninitialized_move(tmp.begin(), tmp.end(), small_begin());
+                } else {
+                    stats::on_copy(tmp.size());
+                    std::uninitialized_copy(tmp.begin(), tmp.end(), small_begin());
                 }
-                tmp.push_back(std::get<1>(vec_data));
-                break;
-            default:
-                std::get<2>(vec_data).resize(sz, elem);
-                return;
+            } else {
+                bigvector const &shared = tmp;
+                stats::on_detach(tmp.size() * sizeof(T));
+                stats::on_copy(tmp.size());
+                std::uninitialized_copy(shared.begin(), shared.end(), small_begin());
+            }
+        } catch (...) {
+            small_.~small_rep();
+            new(&big_) bigvector(std::move(tmp));
+            tag_ = 1;
+            throw;
+        }
+        tag_ = tmp.size() << 1;
+    }
+
+    // fill(dst, n) constructs n elements at dst; it must not read our elements when
+    // sz > capacity(), since growing may move them out first
+    template<typename Fill>
+    void resize_job(size_t sz, Fill fill) {
+        if (is_big()) {
+            big_.resize_with(sz, fill);
+            return;
+        }
+        size_t old_sz = tag_ >> 1;
+        if (sz <= old_sz) {
+            std::destroy(small_begin() + sz, small_end());
+            tag_ = sz << 1;
+        } else if (sz <= SmallSize) {
+            fill(small_end(), sz - old_sz);
+            tag_ = sz << 1;
+        } else {
+            spill(sz);
+            big_.resize_with(sz, fill);
+        }
+    }
+};
+
+template<typename T, size_t N, typename RefCount = plain_ref_count, typename Allocator = std::allocator<T>,
+        typename Growth = doubling_growth>
+using small_vector = vector<T, N, RefCount, Allocator, Growth>;
+
+// A window into a vector's elements that keeps the whole heap storage alive.
+// Reads go straight to the shared storage; the first write copies just the window
+// unless the slice is the storage's last owner.
+template<typename Vector>
+struct vector_slice {
+    typedef typename Vector::value_type T;
+    typedef T value_type;
+    typedef T const *const_iterator;
+
+    vector_slice(Vector const &parent, size_t offset, size_t count) : parent_(parent), offset_(offset), size_(count) {}
+
+    size_t size() const noexcept {
+        return size_;
+    }
+
+    bool empty() const noexcept {
+        return size_ == 0;
+    }
+
+    T const *data() const noexcept {
+        return parent_.data() + offset_;
+    }
+
+    const_iterator begin() const noexcept {
+        return data();
+    }
+
+    const_iterator end() const noexcept {
+        return data() + size_;
+    }
+
+    T const &operator[](size_t index) const {
+        if (index >= size_) {
+            throw std::runtime_error("vector index out of range");
+        }
+        return data()[index];
+    }
+
+    T &operator[](size_t index) {
+        if (index >= size_) {
+            throw std::runtime_error("vector index out of range");
+        }
+        return mutable_data()[index];
+    }
+
+    span<T const> const_span() const noexcept {
+        return span<T const>(data(), size_);
+    }
+
+    span<T> mutable_span() {
+        return span<T>(mutable_data(), size_);
+    }
+
+    // Narrows further, still sharing the same storage
+    vector_slice slice(size_t first, size_t last) const {
+        if (first > last || last > size_) {
+            throw std::runtime_error("vector slice out of range");
+        }
+        return vector_slice(parent_, offset_ + first, last - first);
+    }
+
+    // Shares the storage when the slice covers all of it, copies the window otherwise
+    Vector to_vector() const {
+        if (offset_ == 0 && size_ == parent_.size()) {
+            return parent_;
+        }
+        return Vector(begin(), end(), parent_.get_allocator());
+    }
+
+    friend bool operator==(vector_slice const &a, vector_slice const &b) {
+        return a.size_ == b.size_ && vector_simd::equal(a.data(), b.data(), a.size_);
+    }
+
+    friend bool operator!=(vector_slice const &a, vector_slice const &b) {
+        return !(a == b);
+    }
+
+private:
+    T *mutable_data() {
+        if (parent_.is_big() && parent_.big_.shared()) {
+            parent_ = Vector(begin(), end(), parent_.get_allocator());
+            offset_ = 0;
         }
-        tmp.resize(sz, elem);
-        vec_data = tmp;
+        return parent_.data() + offset_;
     }
-};
\ No newline at end of file
+
+    Vector parent_;
+    size_t offset_;
+    size_t size_;
+};
+
+namespace std {
+    template<typename T, size_t SmallSize, typename RefCount, typename Allocator, typename Growth>
+    struct hash<::vector<T, SmallSize, RefCount, Allocator, Growth>> {
+        size_t operator()(::vector<T, SmallSize, RefCount, Allocator, Growth> const &v) const {
+            return v.hash();
+        }
+    };
+}
@@ -0,0 +1,561 @@
+#include "vector.h"
+#include "counted.h"
+#include "incremental_vector.h"
+#include "large_block_allocator.h"
+#include "malloc_allocator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Usage: vector_bench [--format=text|csv|json] [--max-size=N] [--filter=GROUP]
+//
+// Every measurement is one record: group, container, element, pattern, size, ns_per_op, ops.
+// csv and json (one object per line) are meant for tracking regressions between runs.
+
+namespace
+{
+    enum class output_format
+    {
+        text,
+        csv,
+        json
+    };
+
+    struct options
+    {
+        output_format format = output_format::text;
+        size_t max_size = 1000000;
+        std::string filter;
+    };
+
+    options opts;
+
+    bool enabled(char const* group)
+    {
+        return opts.filter.empty() || opts.filter == group;
+    }
+
+    void report(char const* group, char const* container, char const* element, char const* pattern,
+                size_t size, double ns, size_t ops)
+    {
+        double per_op = ops ? ns / ops : 0;
+        switch (opts.format)
+        {
+        case output_format::text:
+            std::printf("%-14s %-18s %-8s %-14s %10zu %12.3f ns/op\n", group, container, element, pattern, size, per_op);
+            break;
+        case output_format::csv:
+            std::printf("%s,%s,%s,%s,%zu,%.3f,%zu\n", group, container, element, pattern, size, per_op, ops);
+            break;
+        case output_format::json:
+            std::printf("{\"group\":\"%s\",\"container\":\"%s\",\"element\":\"%s\",\"pattern\":\"%s\","
+                        "\"size\":%zu,\"ns_per_op\":%.3f,\"ops\":%zu}\n",
+                        group, container, element, pattern, size, per_op, ops);
+            break;
+        }
+        std::fflush(stdout);
+    }
+
+    template <typename F>
+    double measure_ns(F&& f)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        auto finish = std::chrono::steady_clock::now();
+        return std::chrono::duration<double, std::nano>(finish - start).count();
+    }
+
+    // Keeps the optimizer from dropping the measured work
+    std::atomic<size_t> sink(0);
+
+    // Small cases are repeated so that one measurement covers about this many element operations
+    size_t const WORK = 4000000;
+
+    size_t repeats_for(size_t size)
+    {
+        return std::max<size_t>(1, WORK / std::max<size_t>(size, 1));
+    }
+
+    struct pod64
+    {
+        char bytes[64];
+
+        friend bool operator==(pod64 const& a, pod64 const& b)
+        {
+            return std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) == 0;
+        }
+
+        friend bool operator<(pod64 const& a, pod64 const& b)
+        {
+            return std::memcmp(a.bytes, b.bytes, sizeof(a.bytes)) < 0;
+        }
+    };
+
+    template <typename T>
+    T make_value(size_t i);
+
+    template <>
+    int make_value<int>(size_t i)
+    {
+        return static_cast<int>(i);
+    }
+
+    template <>
+    std::string make_value<std::string>(size_t i)
+    {
+        return "a string that does not fit into SSO #" + std::to_string(i);
+    }
+
+    template <>
+    pod64 make_value<pod64>(size_t i)
+    {
+        pod64 result;
+        std::memset(result.bytes, static_cast<int>(i & 0x7f), sizeof(result.bytes));
+        return result;
+    }
+
+    template <>
+    counted make_value<counted>(size_t i)
+    {
+        return counted(static_cast<int>(i));
+    }
+
+    size_t touch(int const& x)
+    {
+        return static_cast<size_t>(x);
+    }
+
+    size_t touch(std::string const& x)
+    {
+        return x.size();
+    }
+
+    size_t touch(pod64 const& x)
+    {
+        return static_cast<size_t>(x.bytes[0]);
+    }
+
+    size_t touch(counted const& x)
+    {
+        return static_cast<size_t>(static_cast<int>(x));
+    }
+
+    template <typename Container>
+    Container make_filled(size_t size)
+    {
+        Container c;
+        c.reserve(size);
+        for (size_t i = 0; i != size; ++i)
+            c.push_back(make_value<typename Container::value_type>(i));
+        return c;
+    }
+
+    template <typename Container>
+    void bench_push_back(char const* container, char const* element, size_t size)
+    {
+        typedef typename Container::value_type T;
+        T const value = make_value<T>(1);
+        size_t const repeats = repeats_for(size);
+        double ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+            {
+                Container c;
+                for (size_t i = 0; i != size; ++i)
+                    c.push_back(value);
+                sink += c.size();
+            }
+        });
+        report("push_back", container, element, "append", size, ns, std::max<size_t>(size, 1) * repeats);
+    }
+
+    // Every insertion shifts the tail, so sizes are capped to keep the run short
+    template <typename Container>
+    void bench_insert_erase(char const* container, char const* element, size_t size)
+    {
+        typedef typename Container::value_type T;
+        if (size == 0 || size > 100000)
+            return;
+        T const value = make_value<T>(2);
+        size_t const ops = std::min<size_t>(1000, repeats_for(size));
+        char const* const patterns[] = {"front", "middle", "back"};
+        for (size_t p = 0; p != 3; ++p)
+        {
+            Container c = make_filled<Container>(size);
+            auto position = [&](size_t last)
+            {
+                return p == 0 ? 0 : p == 1 ? last / 2 : last;
+            };
+            double ns = measure_ns([&]
+            {
+                for (size_t i = 0; i != ops; ++i)
+                    c.insert(c.begin() + position(c.size()), value);
+            });
+            if (enabled("insert"))
+                report("insert", container, element, patterns[p], size, ns, ops);
+            ns = measure_ns([&]
+            {
+                for (size_t i = 0; i != ops; ++i)
+                    c.erase(c.begin() + position(c.size() - 1));
+            });
+            if (enabled("erase"))
+                report("erase", container, element, patterns[p], size, ns, ops);
+        }
+    }
+
+    // copy: sharing copy; detach: copy and write one element, which forces the deep copy under COW
+    template <typename Container>
+    void bench_copy_detach(char const* container, char const* element, size_t size)
+    {
+        typedef typename Container::value_type T;
+        Container const src = make_filled<Container>(size);
+        T const value = make_value<T>(3);
+        size_t const repeats = std::min<size_t>(repeats_for(size), 100000);
+        double ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+            {
+                Container c = src;
+                sink += c.size();
+            }
+        });
+        if (enabled("copy"))
+            report("copy", container, element, "copy", size, ns, repeats);
+        if (size == 0 || !enabled("detach"))
+            return;
+        ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+            {
+                Container c = src;
+                c[0] = value;
+                sink += c.size();
+            }
+        });
+        report("detach", container, element, "copy+write", size, ns, repeats);
+    }
+
+    // Reads through a const reference in sequential, strided and random order.
+    // sequential is the tight const indexing loop: size() and operator[] const on every step.
+    template <typename Container>
+    void bench_access(char const* container, char const* element, size_t size)
+    {
+        if (size == 0)
+            return;
+        Container const c = make_filled<Container>(size);
+        size_t const repeats = repeats_for(size);
+        size_t acc = 0;
+
+        double ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+                for (size_t i = 0; i != c.size(); ++i)
+                    acc += touch(c[i]);
+        });
+        report("access", container, element, "sequential", size, ns, size * repeats);
+
+        size_t const stride = 16;
+        ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+                for (size_t start = 0; start != stride; ++start)
+                    for (size_t i = start; i < c.size(); i += stride)
+                        acc += touch(c[i]);
+        });
+        report("access", container, element, "strided", size, ns, size * repeats);
+
+        std::vector<size_t> order(std::min<size_t>(size, 1 << 20));
+        std::mt19937_64 rng(size);
+        for (size_t& index : order)
+            index = rng() % size;
+        size_t const random_repeats = repeats_for(order.size());
+        ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != random_repeats; ++r)
+                for (size_t index : order)
+                    acc += touch(c[index]);
+        });
+        report("access", container, element, "random", size, ns, order.size() * random_repeats);
+        sink += acc;
+    }
+
+    // Two equal containers that do not share storage, then one differing in the last element
+    template <typename Container>
+    void bench_compare(char const* container, char const* element, size_t size)
+    {
+        typedef typename Container::value_type T;
+        if (size == 0)
+            return;
+        Container const a = make_filled<Container>(size);
+        Container b = make_filled<Container>(size);
+        size_t const repeats = repeats_for(size);
+        double ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+                sink += a == b;
+        });
+        report("compare", container, element, "equal", size, ns, size * repeats);
+        b[size - 1] = make_value<T>(size);
+        ns = measure_ns([&]
+        {
+            for (size_t r = 0; r != repeats; ++r)
+                sink += a < b;
+        });
+        report("compare", container, element, "less", size, ns, size * repeats);
+    }
+
+    // 0, 1, 2, then powers of ten up to --max-size
+    std::vector<size_t> suite_sizes()
+    {
+        std::vector<size_t> sizes = {0, 1, 2};
+        for (size_t size = 10; size <= opts.max_size; size *= 10)
+            sizes.push_back(size);
+        return sizes;
+    }
+
+    template <typename Container>
+    void bench_suite(char const* container, char const* element)
+    {
+        for (size_t size : suite_sizes())
+        {
+            if (enabled("push_back"))
+                bench_push_back<Container>(container, element, size);
+            if (enabled("insert") || enabled("erase"))
+                bench_insert_erase<Container>(container, element, size);
+            if (enabled("copy") || enabled("detach"))
+                bench_copy_detach<Container>(container, element, size);
+            if (enabled("access"))
+                bench_access<Container>(container, element, size);
+            if (enabled("compare"))
+                bench_compare<Container>(container, element, size);
+        }
+    }
+
+    template <typename T>
+    void bench_element(char const* element)
+    {
+        bench_suite<vector<T>>("vector", element);
+        bench_suite<small_vector<T, 8>>("small_vector<8>", element);
+        bench_suite<std::vector<T>>("std::vector", element);
+    }
+
+    // Builds many short vectors: the inline path and the first spill to the heap
+    template <typename Container>
+    void bench_small_fill(char const* container, char const* element)
+    {
+        typedef typename Container::value_type T;
+        T const value = make_value<T>(4);
+        size_t const rounds = 1000000;
+        for (size_t size = 1; size <= 8; ++size)
+        {
+            double ns = measure_ns([&]
+            {
+                for (size_t round = 0; round != rounds; ++round)
+                {
+                    Container c;
+                    for (size_t i = 0; i != size; ++i)
+                        c.push_back(value);
+                    sink += c.size();
+                }
+            });
+            report("small_fill", container, element, "fresh", size, ns, rounds);
+        }
+    }
+
+    // Writes through operator[] (a COW check per element) versus a single mutable_span()
+    void bench_mutable_loop()
+    {
+        size_t const size = 1000;
+        size_t const passes = 10000;
+        vector<int> c;
+        c.resize(size, 1);
+        double ns = measure_ns([&]
+        {
+            for (size_t pass = 0; pass != passes; ++pass)
+                for (size_t i = 0; i != c.size(); ++i)
+                    c[i] += 1;
+        });
+        report("mutable_loop", "vector", "int", "operator[]", size, ns, size * passes);
+        ns = measure_ns([&]
+        {
+            for (size_t pass = 0; pass != passes; ++pass)
+                for (int& x : c.mutable_span())
+                    x += 1;
+        });
+        report("mutable_loop", "vector", "int", "mutable_span", size, ns, size * passes);
+        sink += c[0];
+    }
+
+    // Every thread keeps copying and dropping the same shared storage
+    template <typename Container>
+    void bench_shared_copies(char const* container, size_t thread_count)
+    {
+        size_t const rounds = 1000000;
+        Container c;
+        c.resize(1000, 1);
+        Container const& shared = c;
+        double ns = measure_ns([&]
+        {
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t != thread_count; ++t)
+            {
+                threads.emplace_back([&]
+                {
+                    size_t local = 0;
+                    for (size_t round = 0; round != rounds; ++round)
+                    {
+                        Container copy = shared;
+                        local += copy.size();
+                    }
+                    sink += local;
+                });
+            }
+            for (std::thread& thread : threads)
+                thread.join();
+        });
+        char pattern[32];
+        std::snprintf(pattern, sizeof(pattern), "%zu_threads", thread_count);
+        report("shared_copies", container, "int", pattern, 1000, ns, rounds);
+    }
+
+    // Fills vectors of log-spaced sizes; reports push_back cost and unused capacity in percent of size
+    template <typename Growth, typename Allocator = std::allocator<int>>
+    void bench_growth(char const* container)
+    {
+        size_t const samples = 60;
+        double overhead = 0, worst = 0;
+        double ns = 0;
+        size_t total = 0;
+        for (size_t sample = 0; sample != samples; ++sample)
+        {
+            size_t size = static_cast<size_t>(std::pow(10.0, 3.0 + 4.0 * sample / samples));
+            total += size;
+            vector<int, 1, plain_ref_count, Allocator, Growth> c;
+            ns += measure_ns([&]
+            {
+                for (size_t i = 0; i != size; ++i)
+                    c.push_back(static_cast<int>(i));
+            });
+            double slack = double(c.capacity() - c.size()) / double(c.size());
+            overhead += slack;
+            worst = std::max(worst, slack);
+        }
+        report("growth", container, "int", "push_back", total, ns, total);
+        report("growth", container, "int", "avg_unused_%", total, 100 * overhead / samples, 1);
+        report("growth", container, "int", "max_unused_%", total, 100 * worst, 1);
+    }
+
+    // Times each push_back on its own; the upper percentiles show what growth steps cost
+    template <typename Container>
+    void bench_latency(char const* container)
+    {
+        size_t const size = opts.max_size * 8;
+        std::vector<double> samples(size);
+        Container c;
+        for (size_t i = 0; i != size; ++i)
+        {
+            samples[i] = measure_ns([&]
+            {
+                c.push_back(static_cast<int>(i));
+            });
+        }
+        sink += c.size();
+        std::sort(samples.begin(), samples.end());
+        struct
+        {
+            char const* name;
+            double quantile;
+        } const points[] = {{"p50", 0.5}, {"p99", 0.99}, {"p99.9", 0.999}, {"p99.99", 0.9999}, {"max", 1.0}};
+        for (auto const& point : points)
+        {
+            size_t index = std::min(size - 1, static_cast<size_t>(point.quantile * size));
+            report("latency", container, "int", point.name, size, samples[index], 1);
+        }
+    }
+
+    bool parse_options(int argc, char** argv)
+    {
+        for (int i = 1; i != argc; ++i)
+        {
+            std::string arg = argv[i];
+            if (arg == "--format=text")
+                opts.format = output_format::text;
+            else if (arg == "--format=csv")
+                opts.format = output_format::csv;
+            else if (arg == "--format=json")
+                opts.format = output_format::json;
+            else if (arg.compare(0, 11, "--max-size=") == 0)
+                opts.max_size = std::stoull(arg.substr(11));
+            else if (arg.compare(0, 9, "--filter=") == 0)
+                opts.filter = arg.substr(9);
+            else
+            {
+                std::fprintf(stderr, "usage: %s [--format=text|csv|json] [--max-size=N] [--filter=GROUP]\n", argv[0]);
+                return false;
+            }
+        }
+        return true;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    if (!parse_options(argc, argv))
+        return 1;
+
+    if (opts.format == output_format::csv)
+        std::printf("group,container,element,pattern,size,ns_per_op,ops\n");
+
+    bench_element<int>("int");
+    bench_element<std::string>("string");
+    bench_element<pod64>("pod64");
+    bench_element<counted>("counted");
+
+    if (enabled("small_fill"))
+    {
+        bench_small_fill<vector<int>>("vector", "int");
+        bench_small_fill<small_vector<int, 8>>("small_vector<8>", "int");
+        bench_small_fill<std::vector<int>>("std::vector", "int");
+        bench_small_fill<vector<std::string>>("vector", "string");
+        bench_small_fill<small_vector<std::string, 8>>("small_vector<8>", "string");
+    }
+
+    if (enabled("mutable_loop"))
+        bench_mutable_loop();
+
+    if (enabled("shared_copies"))
+    {
+        bench_shared_copies<vector<int>>("vector<plain>", 1);
+        for (size_t thread_count : {1, 2, 4, 8})
+            bench_shared_copies<vector<int, 1, atomic_ref_count>>("vector<atomic>", thread_count);
+    }
+
+    if (enabled("growth"))
+    {
+        bench_growth<doubling_growth>("doubling");
+        bench_growth<one_and_half_growth>("1.5x");
+        bench_growth<capped_growth<(1 << 20)>>("capped<1M>");
+        bench_growth<doubling_growth, malloc_allocator<int>>("doubling+rounded");
+        bench_growth<one_and_half_growth, malloc_allocator<int>>("1.5x+rounded");
+        bench_growth<doubling_growth, large_block_allocator<int>>("doubling+large_block");
+        bench_growth<doubling_growth, large_block_allocator<int, (size_t(2) << 20), large_block_populate>>(
+                "doubling+large_block+populate");
+    }
+
+    if (enabled("latency"))
+    {
+        bench_latency<vector<int>>("vector");
+        bench_latency<std::vector<int>>("std::vector");
+        bench_latency<incremental_vector<int>>("incremental");
+    }
+
+    return sink.load() == 1 ? 2 : 0;
+}
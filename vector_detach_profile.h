@@ -0,0 +1,185 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Every user of vector.h includes this header, so it only pulls in the
+// reporting machinery when profiling is on
+#ifdef VECTOR_DETACH_PROFILE
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define VECTOR_DETACH_BACKTRACE 1
+#endif
+#endif
+
+// Where copy-on-write detaches happen. A non-const front(), data() or
+// operator[] on a shared vector copies the whole buffer, and nothing at the
+// call site says so. Define VECTOR_DETACH_PROFILE for the whole program to
+// record every detach: the stack is captured and hashed, and detaches from the
+// same stack add up into one site with a count and byte total. sites() and
+// print_report() read the table on demand, report_at_exit() prints it when the
+// program ends. forbid_above(n) makes larger detaches call the limit handler,
+// which by default prints the stack and aborts, to catch accidental deep copies
+// in staging. Without the define every hook is an empty inline function, and
+// sites() and print_report(), which would have nothing to report, are not
+// declared. Like VECTOR_STATS, the define must be the same in every translation
+// unit of a program, or the hooks break the one-definition rule silently.
+namespace vector_detach_profile {
+    constexpr size_t max_frames = 24;
+
+    struct site {
+        uint64_t stack_hash = 0;
+        size_t detaches = 0;
+        size_t bytes = 0;
+        size_t largest = 0;
+        size_t frame_count = 0;
+        void *frames[max_frames] = {};
+    };
+
+    // Called with the offending detach alone (detaches == 1); must not throw
+    typedef void (*limit_handler)(site const &detach);
+
+#ifdef VECTOR_DETACH_PROFILE
+    constexpr bool enabled = true;
+
+    inline void print_site(FILE *out, site const &s) {
+        std::fprintf(out, "%zu detaches, %zu bytes, largest %zu bytes, stack %016llx\n", s.detaches, s.bytes, s.largest,
+                     (unsigned long long) s.stack_hash);
+#if VECTOR_DETACH_BACKTRACE
+        std::fflush(out);
+        backtrace_symbols_fd(s.frames, (int) s.frame_count, fileno(out));
+#endif
+    }
+
+    namespace detail {
+        inline std::mutex mutex;
+        inline std::unordered_map<uint64_t, site> sites;
+        inline std::atomic<size_t> unrecorded{0};
+        inline std::atomic<size_t> limit{SIZE_MAX};
+        inline std::atomic<limit_handler> handler{nullptr};
+
+        inline void abort_on_limit(site const &detach) {
+            std::fprintf(stderr, "vector detach of %zu bytes is over the limit of %zu bytes\n", detach.bytes,
+                         limit.load(std::memory_order_relaxed));
+            print_site(stderr, detach);
+            std::abort();
+        }
+    }
+
+    // Detaches of more than bytes call the limit handler; SIZE_MAX turns the check off
+    inline void forbid_above(size_t bytes) noexcept {
+        detail::limit.store(bytes, std::memory_order_relaxed);
+    }
+
+    // nullptr restores the handler that aborts
+    inline void on_limit(limit_handler handler) noexcept {
+        detail::handler.store(handler, std::memory_order_relaxed);
+    }
+
+    inline void record(size_t bytes) noexcept {
+        site detach;
+        detach.detaches = 1;
+        detach.bytes = bytes;
+        detach.largest = bytes;
+#if VECTOR_DETACH_BACKTRACE
+        // frame 0 is this function
+        void *frames[max_frames + 1];
+        int n = backtrace(frames, (int) max_frames + 1);
+        detach.frame_count = n > 1 ? (size_t) n - 1 : 0;
+        std::copy(frames + 1, frames + 1 + detach.frame_count, detach.frames);
+#endif
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i != detach.frame_count; ++i) {
+            h = (h ^ (uint64_t) (uintptr_t) detach.frames[i]) * 0x100000001b3ull;
+        }
+        detach.stack_hash = h;
+        if (bytes > detail::limit.load(std::memory_order_relaxed)) {
+            limit_handler handler = detail::handler.load(std::memory_order_relaxed);
+            (handler ? handler : detail::abort_on_limit)(detach);
+        }
+        try {
+            std::lock_guard<std::mutex> lock(detail::mutex);
+            auto [it, fresh] = detail::sites.try_emplace(h, detach);
+            if (!fresh) {
+                ++it->second.detaches;
+                it->second.bytes += bytes;
+                it->second.largest = std::max(it->second.largest, bytes);
+            }
+        } catch (...) {
+            // the table could not grow; the detach still counts here
+            detail::unrecorded.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    // Sites with the most bytes first
+    inline std::vector<site> sites() {
+        std::vector<site> result;
+        {
+            std::lock_guard<std::mutex> lock(detail::mutex);
+            result.reserve(detail::sites.size());
+            for (auto const &entry : detail::sites) {
+                result.push_back(entry.second);
+            }
+        }
+        std::sort(result.begin(), result.end(), [](site const &a, site const &b) {
+            return a.bytes > b.bytes;
+        });
+        return result;
+    }
+
+    // Detaches that happened while the site table could not allocate
+    inline size_t unrecorded() noexcept {
+        return detail::unrecorded.load(std::memory_order_relaxed);
+    }
+
+    inline void reset() noexcept {
+        std::lock_guard<std::mutex> lock(detail::mutex);
+        detail::sites.clear();
+        detail::unrecorded.store(0, std::memory_order_relaxed);
+    }
+
+    // The top sites by bytes, with symbolized stacks where the platform has them
+    inline void print_report(FILE *out = stderr, size_t top = 20) {
+        std::vector<site> all = sites();
+        size_t total = 0;
+        for (site const &s : all) {
+            total += s.bytes;
+        }
+        std::fprintf(out, "vector detaches: %zu sites, %zu bytes copied, %zu unrecorded\n", all.size(), total,
+                     unrecorded());
+        for (size_t i = 0; i != all.size() && i != top; ++i) {
+            print_site(out, all[i]);
+        }
+    }
+
+    inline void report_at_exit() {
+        static bool const registered = std::atexit([] {
+            print_report();
+        }) == 0;
+        (void) registered;
+    }
+#else
+    constexpr bool enabled = false;
+
+    inline void forbid_above(size_t) noexcept {}
+
+    inline void on_limit(limit_handler) noexcept {}
+
+    inline void record(size_t) noexcept {}
+
+    inline size_t unrecorded() noexcept {
+        return 0;
+    }
+
+    inline void reset() noexcept {}
+
+    inline void report_at_exit() {}
+#endif
+}
@@ -0,0 +1,81 @@
+// The detach profiler swallows allocation failures of its site table, so these
+// tests stay out of vector_testing.cpp, where faulty_run expects every injected
+// fault to surface. This is the only translation unit of its executable, so the
+// switch holds program-wide.
+#define VECTOR_DETACH_PROFILE
+
+#include <gtest/gtest.h>
+#include "vector.h"
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+typedef vector<int> container_int;
+
+static std::atomic<size_t> detach_over_limit{0};
+
+TEST(correctness, detach_profile_sites)
+{
+    container_int a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i);
+    vector_detach_profile::reset();
+    for (int i = 0; i != 3; ++i)
+    {
+        container_int copy = a;
+        copy.data()[0] = -1;
+    }
+    container_int other = a;
+    other.front() = 5;
+    std::vector<vector_detach_profile::site> sites = vector_detach_profile::sites();
+    size_t detaches = 0;
+    size_t bytes = 0;
+    for (vector_detach_profile::site const& s : sites)
+    {
+        detaches += s.detaches;
+        bytes += s.bytes;
+        EXPECT_EQ(1000 * sizeof(int), s.largest);
+    }
+    EXPECT_EQ(4u, detaches);
+    EXPECT_EQ(4 * 1000 * sizeof(int), bytes);
+    ASSERT_EQ(2u, sites.size());
+    EXPECT_EQ(3u, sites[0].detaches);
+    EXPECT_NE(sites[0].stack_hash, sites[1].stack_hash);
+
+    FILE* out = std::tmpfile();
+    vector_detach_profile::print_report(out);
+    std::rewind(out);
+    char line[128] = {};
+    ASSERT_TRUE(std::fgets(line, sizeof line, out));
+    EXPECT_EQ(std::string("vector detaches: 2 sites, 16000 bytes copied, 0 unrecorded\n"), line);
+    std::fclose(out);
+    vector_detach_profile::reset();
+    EXPECT_TRUE(vector_detach_profile::sites().empty());
+}
+
+TEST(correctness, detach_profile_limit)
+{
+    vector_detach_profile::on_limit([](vector_detach_profile::site const& detach)
+    {
+        detach_over_limit.fetch_add(detach.bytes);
+    });
+    vector_detach_profile::forbid_above(100 * sizeof(int));
+    container_int small;
+    container_int large;
+    for (int i = 0; i != 200; ++i)
+    {
+        large.push_back(i);
+        if (i < 100)
+            small.push_back(i);
+    }
+    container_int small_copy = small;
+    small_copy[0] = 1;
+    EXPECT_EQ(0u, detach_over_limit.load());
+    container_int large_copy = large;
+    large_copy[0] = 1;
+    EXPECT_EQ(200 * sizeof(int), detach_over_limit.load());
+    vector_detach_profile::forbid_above(SIZE_MAX);
+    vector_detach_profile::on_limit(nullptr);
+    vector_detach_profile::reset();
+}
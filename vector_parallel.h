@@ -0,0 +1,223 @@
+#pragma once
+
+#include "vector.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Multi-threaded bulk operations on vector. Each call splits its range into
+// contiguous parts, runs them on fresh threads (the caller takes the first part)
+// and joins them before returning. It goes wide only when every thread gets at
+// least min_bytes_per_thread, so small vectors take the plain serial path.
+namespace vector_parallel {
+    // Below this, starting a thread costs about as much as the work it takes over
+    constexpr size_t min_bytes_per_thread = size_t(1) << 20;
+
+    // Element types whose storage can be filled from raw memory with reserve_and_write
+    template<typename T>
+    constexpr bool is_bulk = std::is_trivially_copyable_v<T> && std::is_trivially_default_constructible_v<T>;
+
+    // Caps the threads a call can use; 0 means one per hardware thread
+    inline std::atomic<size_t> thread_limit{0};
+
+    inline size_t max_threads() noexcept {
+        size_t limit = thread_limit.load(std::memory_order_relaxed);
+        if (limit != 0) {
+            return limit;
+        }
+        unsigned n = std::thread::hardware_concurrency();
+        return n ? n : 1;
+    }
+
+    inline size_t thread_count(size_t bytes) noexcept {
+        return std::clamp<size_t>(bytes / min_bytes_per_thread, 1, max_threads());
+    }
+
+    // Calls part(first, last) for parts of [0, n) on parts threads; the first
+    // exception thrown is rethrown once all of them have finished
+    template<typename Part>
+    void for_each_part(size_t n, size_t parts, Part const &part) {
+        if (parts <= 1) {
+            part(size_t(0), n);
+            return;
+        }
+        std::exception_ptr error;
+        std::mutex error_mutex;
+        auto run = [&](size_t i) noexcept {
+            try {
+                part(n / parts * i + std::min(i, n % parts), n / parts * (i + 1) + std::min(i + 1, n % parts));
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(error_mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        try {
+            workers.reserve(parts - 1);
+            for (size_t i = 1; i != parts; ++i) {
+                workers.emplace_back(run, i);
+            }
+        } catch (...) {
+            for (std::thread &t : workers) {
+                t.join();
+            }
+            throw;
+        }
+        run(0);
+        for (std::thread &t : workers) {
+            t.join();
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+
+// Builds a vector from a random-access range, copying parts of it concurrently
+template<typename Vector, typename RandomIt>
+Vector parallel_construct(RandomIt first, RandomIt last,
+                          typename Vector::allocator_type const &alloc = typename Vector::allocator_type()) {
+    typedef typename Vector::value_type T;
+    static_assert(std::is_base_of_v<std::random_access_iterator_tag, iterator_category_t<RandomIt>>,
+                  "parallel_construct splits the range, it needs random-access iterators");
+    size_t n = (size_t) std::distance(first, last);
+    size_t parts = vector_parallel::thread_count(n * sizeof(T));
+    if constexpr (!vector_parallel::is_bulk<T>) {
+        return Vector(first, last, alloc);
+    } else {
+        if (parts <= 1) {
+            return Vector(first, last, alloc);
+        }
+        Vector result(alloc);
+        result.reserve(n);
+        result.reserve_and_write(n, [&](T *dst, size_t) {
+            vector_parallel::for_each_part(n, parts, [&](size_t b, size_t e) {
+                std::copy(first + b, first + e, dst + b);
+            });
+            return n;
+        });
+        return result;
+    }
+}
+
+// Deep copy with storage of its own, unlike the copy constructor which shares it
+template<typename Vector>
+Vector parallel_copy(Vector const &src) {
+    typedef typename Vector::allocator_type Allocator;
+    Allocator alloc = std::allocator_traits<Allocator>::select_on_container_copy_construction(src.get_allocator());
+    span<typename Vector::value_type const> elems = src.const_span();
+    return parallel_construct<Vector>(elems.begin(), elems.end(), alloc);
+}
+
+// Gives v storage of its own if it shares it, copying in parallel
+template<typename Vector>
+void parallel_detach(Vector &v) {
+    if (v.shared()) {
+        v = parallel_copy(v);
+    }
+}
+
+// Like v.resize(n, value), filling the new elements in parallel
+template<typename Vector>
+void parallel_resize(Vector &v, size_t n, typename Vector::value_type const &value) {
+    typedef typename Vector::value_type T;
+    size_t parts = vector_parallel::thread_count(n * sizeof(T));
+    if constexpr (vector_parallel::is_bulk<T>) {
+        if (parts > 1 && n > v.size()) {
+            // one pass builds the new block; value may be one of v's elements
+            T fill = value;
+            span<T const> old = v.const_span();
+            Vector result(v.get_allocator());
+            result.reserve(n);
+            result.reserve_and_write(n, [&](T *dst, size_t) {
+                vector_parallel::for_each_part(n, parts, [&](size_t b, size_t e) {
+                    size_t split = std::clamp(old.size(), b, e);
+                    std::copy(old.begin() + b, old.begin() + split, dst + b);
+                    std::fill(dst + split, dst + e, fill);
+                });
+                return n;
+            });
+            v = std::move(result);
+            return;
+        }
+    }
+    v.resize(n, value);
+}
+
+// Assigns value to every element
+template<typename Vector>
+void parallel_fill(Vector &v, typename Vector::value_type const &value) {
+    typedef typename Vector::value_type T;
+    // value may be one of v's elements, which the workers overwrite
+    T fill = value;
+    if (v.shared()) {
+        // the shared elements would only be overwritten
+        size_t n = v.size();
+        v = Vector(v.get_allocator());
+        parallel_resize(v, n, fill);
+        return;
+    }
+    span<T> elems = v.mutable_span();
+    vector_parallel::for_each_part(elems.size(), vector_parallel::thread_count(elems.size() * sizeof(T)),
+                                   [&](size_t b, size_t e) {
+        std::fill(elems.begin() + b, elems.begin() + e, fill);
+    });
+}
+
+// Replaces each element x with f(x); f may be called concurrently
+template<typename Vector, typename F>
+void parallel_transform(Vector &v, F f) {
+    typedef typename Vector::value_type T;
+    parallel_detach(v);
+    span<T> elems = v.mutable_span();
+    vector_parallel::for_each_part(elems.size(), vector_parallel::thread_count(elems.size() * sizeof(T)),
+                                   [&](size_t b, size_t e) {
+        std::transform(elems.begin() + b, elems.begin() + e, elems.begin() + b, f);
+    });
+}
+
+// Sorts parts concurrently, then merges neighbouring runs pairwise, each round in parallel
+template<typename Vector, typename Compare = std::less<>>
+void parallel_sort(Vector &v, Compare comp = Compare()) {
+    typedef typename Vector::value_type T;
+    parallel_detach(v);
+    span<T> elems = v.mutable_span();
+    size_t n = elems.size();
+    size_t parts = vector_parallel::thread_count(n * sizeof(T));
+    if (parts <= 1) {
+        std::sort(elems.begin(), elems.end(), comp);
+        return;
+    }
+    // run i is [bounds[i], bounds[i + 1]), split the way for_each_part splits
+    std::vector<size_t> bounds(parts + 1);
+    for (size_t i = 0; i <= parts; ++i) {
+        bounds[i] = n / parts * i + std::min(i, n % parts);
+    }
+    vector_parallel::for_each_part(parts, parts, [&](size_t b, size_t e) {
+        for (size_t i = b; i != e; ++i) {
+            std::sort(elems.begin() + bounds[i], elems.begin() + bounds[i + 1], comp);
+        }
+    });
+    for (size_t width = 1; width < parts; width *= 2) {
+        size_t pairs = (parts + 2 * width - 1) / (2 * width);
+        vector_parallel::for_each_part(pairs, pairs, [&](size_t b, size_t e) {
+            for (size_t p = b; p != e; ++p) {
+                size_t lo = 2 * width * p;
+                size_t mid = std::min(lo + width, parts);
+                size_t hi = std::min(lo + 2 * width, parts);
+                std::inplace_merge(elems.begin() + bounds[lo], elems.begin() + bounds[mid],
+                                   elems.begin() + bounds[hi], comp);
+            }
+        });
+    }
+}
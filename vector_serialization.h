@@ -0,0 +1,308 @@
+#pragma once
+
+#include "vector.h"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Binary snapshot of a vector: a 40-byte header followed by the payload.
+// Trivially copyable elements are stored as their raw bytes, anything else
+// through vector_codec<T>. Fields are in the writer's byte order; a reader
+// with the other order rejects the snapshot instead of guessing.
+struct serialized_header {
+    static constexpr uint32_t MAGIC = 0x43455643;  // "CVEC" in little-endian
+    static constexpr uint16_t VERSION = 1;
+    static constexpr uint16_t BYTE_ORDER_MARK = 0x0102;
+
+    enum : uint32_t {
+        raw_elements = 0,
+        encoded_elements = 1,
+    };
+
+    uint32_t magic;
+    uint16_t version;
+    uint16_t byte_order;
+    uint32_t element_size;
+    uint32_t encoding;
+    uint64_t count;
+    uint64_t payload_bytes;
+    uint64_t checksum;  // of the payload
+};
+
+static_assert(sizeof(serialized_header) == 40, "serialized_header must have no padding");
+
+// Element encoding for types that are not trivially copyable. A specialization provides
+//   static size_t encoded_size(T const &);
+//   static unsigned char *encode(T const &, unsigned char *dst);           returns the new end
+//   static T decode(unsigned char const *&src, unsigned char const *end);  throws if src is short
+template<typename T, typename = void>
+struct vector_codec;
+
+template<typename Char, typename Traits, typename Alloc>
+struct vector_codec<std::basic_string<Char, Traits, Alloc>> {
+    typedef std::basic_string<Char, Traits, Alloc> string;
+
+    static size_t encoded_size(string const &s) noexcept {
+        return sizeof(uint64_t) + s.size() * sizeof(Char);
+    }
+
+    static unsigned char *encode(string const &s, unsigned char *dst) noexcept {
+        uint64_t len = s.size();
+        std::memcpy(dst, &len, sizeof(len));
+        std::memcpy(dst + sizeof(len), s.data(), s.size() * sizeof(Char));
+        return dst + encoded_size(s);
+    }
+
+    static string decode(unsigned char const *&src, unsigned char const *end) {
+        uint64_t len;
+        if ((size_t) (end - src) < sizeof(len)) {
+            throw std::runtime_error("serialized vector is truncated");
+        }
+        std::memcpy(&len, src, sizeof(len));
+        src += sizeof(len);
+        if (len > (size_t) (end - src) / sizeof(Char)) {
+            throw std::runtime_error("serialized vector is truncated");
+        }
+        string result(len, Char());
+        std::memcpy(result.data(), src, len * sizeof(Char));
+        src += len * sizeof(Char);
+        return result;
+    }
+};
+
+namespace vector_serialization {
+    template<typename T>
+    constexpr bool is_raw = std::is_trivially_copyable_v<T>;
+
+    // FNV-1a over 64-bit words: catches corruption, not tampering
+    inline uint64_t checksum(void const *data, size_t bytes) noexcept {
+        unsigned char const *p = static_cast<unsigned char const *>(data);
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (; bytes >= 8; p += 8, bytes -= 8) {
+            uint64_t word;
+            std::memcpy(&word, p, 8);
+            h = (h ^ word) * 0x100000001b3ull;
+            h ^= h >> 29;
+        }
+        for (; bytes != 0; ++p, --bytes) {
+            h = (h ^ *p) * 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    template<typename T>
+    serialized_header make_header(size_t count, void const *payload, size_t bytes) noexcept {
+        serialized_header h;
+        h.magic = serialized_header::MAGIC;
+        h.version = serialized_header::VERSION;
+        h.byte_order = serialized_header::BYTE_ORDER_MARK;
+        h.element_size = sizeof(T);
+        h.encoding = is_raw<T> ? serialized_header::raw_elements : serialized_header::encoded_elements;
+        h.count = count;
+        h.payload_bytes = bytes;
+        h.checksum = checksum(payload, bytes);
+        return h;
+    }
+
+    template<typename T>
+    void check_header(serialized_header const &h) {
+        if (h.magic != serialized_header::MAGIC) {
+            throw std::runtime_error(__builtin_bswap32(h.magic) == serialized_header::MAGIC
+                                     ? "serialized vector has foreign byte order" : "not a serialized vector");
+        }
+        if (h.version != serialized_header::VERSION || h.byte_order != serialized_header::BYTE_ORDER_MARK) {
+            throw std::runtime_error("unsupported serialized vector version");
+        }
+        uint32_t encoding = is_raw<T> ? serialized_header::raw_elements : serialized_header::encoded_elements;
+        if (h.element_size != sizeof(T) || h.encoding != encoding) {
+            throw std::runtime_error("serialized vector holds a different element type");
+        }
+        if (h.payload_bytes > PTRDIFF_MAX || (is_raw<T> && h.payload_bytes / sizeof(T) != h.count) ||
+            (is_raw<T> && h.payload_bytes % sizeof(T) != 0)) {
+            throw std::runtime_error("serialized vector header is corrupt");
+        }
+    }
+
+    // Resumes after short writes; iov is consumed
+    inline void write_all(int fd, iovec *iov, int iovcnt) {
+        while (iovcnt > 0) {
+            ssize_t n = ::writev(fd, iov, iovcnt);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "writev");
+            }
+            size_t done = (size_t) n;
+            for (; iovcnt > 0 && done >= iov->iov_len; ++iov, --iovcnt) {
+                done -= iov->iov_len;
+            }
+            if (iovcnt > 0) {
+                iov->iov_base = static_cast<char *>(iov->iov_base) + done;
+                iov->iov_len -= done;
+            }
+        }
+    }
+
+    inline void read_all(int fd, void *dst, size_t bytes) {
+        char *p = static_cast<char *>(dst);
+        while (bytes != 0) {
+            ssize_t n = ::read(fd, p, bytes);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::system_error(errno, std::generic_category(), "read");
+            }
+            if (n == 0) {
+                throw std::runtime_error("serialized vector is truncated");
+            }
+            p += n;
+            bytes -= (size_t) n;
+        }
+    }
+
+    // Input iterator over encoded elements; dereferencing yields a prvalue so that
+    // the vector's iterator constructor moves each element in
+    template<typename T>
+    struct decode_iterator {
+        typedef std::input_iterator_tag iterator_category;
+        typedef T value_type;
+        typedef ptrdiff_t difference_type;
+        typedef T const *pointer;
+        typedef T reference;
+
+        decode_iterator(unsigned char const *pos, unsigned char const *end, uint64_t index) noexcept
+                : pos_(pos), end_(end), index_(index) {}
+
+        T operator*() {
+            next_ = pos_;
+            return vector_codec<T>::decode(next_, end_);
+        }
+
+        decode_iterator &operator++() {
+            if (!next_) {
+                next_ = pos_;
+                vector_codec<T>::decode(next_, end_);
+            }
+            pos_ = next_;
+            next_ = nullptr;
+            ++index_;
+            return *this;
+        }
+
+        friend bool operator==(decode_iterator const &a, decode_iterator const &b) noexcept {
+            return a.index_ == b.index_;
+        }
+
+        friend bool operator!=(decode_iterator const &a, decode_iterator const &b) noexcept {
+            return a.index_ != b.index_;
+        }
+
+    private:
+        unsigned char const *pos_;
+        unsigned char const *next_ = nullptr;
+        unsigned char const *end_;
+        uint64_t index_;
+    };
+}
+
+// Writes the header and the payload with one writev; the payload of raw elements
+// goes straight from the vector's storage
+template<typename Vector>
+void write_to(int fd, Vector const &v) {
+    typedef typename Vector::value_type T;
+    if constexpr (vector_serialization::is_raw<T>) {
+        size_t bytes = v.size() * sizeof(T);
+        serialized_header h = vector_serialization::make_header<T>(v.size(), v.data(), bytes);
+        iovec iov[2] = {{&h, sizeof(h)}, {const_cast<T *>(v.data()), bytes}};
+        vector_serialization::write_all(fd, iov, 2);
+    } else {
+        size_t bytes = 0;
+        for (T const &elem : v) {
+            bytes += vector_codec<T>::encoded_size(elem);
+        }
+        vector<unsigned char> payload;
+        payload.reserve_and_write(bytes, [&](unsigned char *dst, size_t) {
+            for (T const &elem : v) {
+                dst = vector_codec<T>::encode(elem, dst);
+            }
+            return bytes;
+        });
+        unsigned char const *data = payload.const_span().data();
+        serialized_header h = vector_serialization::make_header<T>(v.size(), data, bytes);
+        iovec iov[2] = {{&h, sizeof(h)}, {const_cast<unsigned char *>(data), bytes}};
+        vector_serialization::write_all(fd, iov, 2);
+    }
+}
+
+// Reads one snapshot written by write_to. Raw elements are read straight into the
+// result's storage; others are decoded through the iterator constructor.
+template<typename Vector>
+Vector read_from(int fd, typename Vector::allocator_type const &alloc = typename Vector::allocator_type()) {
+    typedef typename Vector::value_type T;
+    serialized_header h;
+    vector_serialization::read_all(fd, &h, sizeof(h));
+    vector_serialization::check_header<T>(h);
+    if constexpr (vector_serialization::is_raw<T>) {
+        Vector result(alloc);
+        result.reserve((size_t) h.count);
+        result.reserve_and_write((size_t) h.count, [&](T *dst, size_t n) {
+            vector_serialization::read_all(fd, dst, n * sizeof(T));
+            return n;
+        });
+        if (vector_serialization::checksum(result.data(), (size_t) h.payload_bytes) != h.checksum) {
+            throw std::runtime_error("serialized vector checksum mismatch");
+        }
+        return result;
+    } else {
+        vector<unsigned char> payload;
+        payload.reserve((size_t) h.payload_bytes);
+        payload.reserve_and_write((size_t) h.payload_bytes, [&](unsigned char *dst, size_t n) {
+            vector_serialization::read_all(fd, dst, n);
+            return n;
+        });
+        unsigned char const *data = payload.const_span().data();
+        if (vector_serialization::checksum(data, payload.size()) != h.checksum) {
+            throw std::runtime_error("serialized vector checksum mismatch");
+        }
+        typedef vector_serialization::decode_iterator<T> decoder;
+        unsigned char const *end = data + payload.size();
+        return Vector(decoder(data, end, 0), decoder(end, end, h.count), alloc);
+    }
+}
+
+// Zero-copy load of raw elements: validates a snapshot held in memory (a mapped
+// file, a received message) and returns a view of its payload. The buffer must
+// stay alive and unchanged while the view is in use.
+template<typename T>
+span<T const> view_serialized(void const *buf, size_t len) {
+    static_assert(vector_serialization::is_raw<T>, "only raw elements can be viewed in place");
+    serialized_header h;
+    if (len < sizeof(h)) {
+        throw std::runtime_error("serialized vector is truncated");
+    }
+    std::memcpy(&h, buf, sizeof(h));
+    vector_serialization::check_header<T>(h);
+    if (h.payload_bytes > len - sizeof(h)) {
+        throw std::runtime_error("serialized vector is truncated");
+    }
+    unsigned char const *payload = static_cast<unsigned char const *>(buf) + sizeof(h);
+    if (reinterpret_cast<uintptr_t>(payload) % alignof(T) != 0) {
+        throw std::runtime_error("serialized vector payload is misaligned");
+    }
+    if (vector_serialization::checksum(payload, (size_t) h.payload_bytes) != h.checksum) {
+        throw std::runtime_error("serialized vector checksum mismatch");
+    }
+    return span<T const>(reinterpret_cast<T const *>(payload), (size_t) h.count);
+}
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VECTOR_SIMD_X86 1
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define VECTOR_SIMD_NEON 1
+#endif
+
+// Specialize for types whose == holds exactly when the object representations are equal
+// (no padding, no floating point). Such elements are compared, searched and counted as raw
+// bytes; operator< is still used on the first differing element.
+template<typename T>
+struct is_trivially_comparable
+        : std::bool_constant<std::is_integral_v<T> || std::is_enum_v<T> || std::is_pointer_v<T>> {
+};
+
+// Byte kernels behind vector's comparisons, find() and count(). SSE2 is the x86 baseline and
+// AVX2 is picked at run time when the CPU has it; aarch64 uses NEON; anything else runs scalar.
+namespace vector_simd {
+    // Index of the first element where a and b differ, n if there is none
+    template<typename T>
+    size_t mismatch_scalar(T const *a, T const *b, size_t n) noexcept {
+        return std::mismatch(a, a + n, b).first - a;
+    }
+
+    template<typename T>
+    size_t find_scalar(T const *a, size_t n, T value) noexcept {
+        return std::find(a, a + n, value) - a;
+    }
+
+    template<typename T>
+    size_t count_scalar(T const *a, size_t n, T value) noexcept {
+        return std::count(a, a + n, value);
+    }
+
+#if VECTOR_SIMD_X86
+    inline bool has_avx2() noexcept {
+#if defined(__GNUC__)
+        static bool const result = __builtin_cpu_supports("avx2");
+        return result;
+#else
+        return false;
+#endif
+    }
+
+    inline unsigned count_trailing_zeros(unsigned mask) noexcept {
+        return __builtin_ctz(mask);
+    }
+
+    // Byte mask of the lanes of width W that are equal in x and y
+    template<size_t W>
+    inline unsigned equal_mask_sse2(__m128i x, __m128i y) noexcept {
+        if constexpr (W == 1) {
+            return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        } else if constexpr (W == 2) {
+            return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi16(x, y));
+        } else if constexpr (W == 4) {
+            return (unsigned) _mm_movemask_epi8(_mm_cmpeq_epi32(x, y));
+        } else {
+            __m128i halves = _mm_cmpeq_epi32(x, y);
+            return (unsigned) _mm_movemask_epi8(_mm_and_si128(halves, _mm_shuffle_epi32(halves, 0xb1)));
+        }
+    }
+
+    template<size_t W>
+    __attribute__((target("avx2"))) inline unsigned equal_mask_avx2(__m256i x, __m256i y) noexcept {
+        if constexpr (W == 1) {
+            return (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        } else if constexpr (W == 2) {
+            return (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi16(x, y));
+        } else if constexpr (W == 4) {
+            return (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi32(x, y));
+        } else {
+            return (unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi64(x, y));
+        }
+    }
+
+    template<typename T>
+    __m128i splat_sse2(T value) noexcept {
+        unsigned char bytes[16];
+        for (size_t i = 0; i != 16; i += sizeof(T)) {
+            std::memcpy(bytes + i, &value, sizeof(T));
+        }
+        return _mm_loadu_si128(reinterpret_cast<__m128i const *>(bytes));
+    }
+
+    inline size_t mismatch_bytes_sse2(unsigned char const *a, unsigned char const *b, size_t n) noexcept {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<__m128i const *>(a + i));
+            __m128i y = _mm_loadu_si128(reinterpret_cast<__m128i const *>(b + i));
+            unsigned mask = equal_mask_sse2<1>(x, y) ^ 0xffffu;
+            if (mask) {
+                return i + count_trailing_zeros(mask);
+            }
+        }
+        return i + mismatch_scalar(a + i, b + i, n - i);
+    }
+
+    __attribute__((target("avx2")))
+    inline size_t mismatch_bytes_avx2(unsigned char const *a, unsigned char const *b, size_t n) noexcept {
+        size_t i = 0;
+        for (; i + 32 <= n; i += 32) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i));
+            __m256i y = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(b + i));
+            unsigned mask = ~equal_mask_avx2<1>(x, y);
+            if (mask) {
+                return i + count_trailing_zeros(mask);
+            }
+        }
+        return i + mismatch_bytes_sse2(a + i, b + i, n - i);
+    }
+
+    template<typename T>
+    size_t find_sse2(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 16 / sizeof(T);
+        __m128i needle = splat_sse2(value);
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            unsigned mask = equal_mask_sse2<sizeof(T)>(_mm_loadu_si128(reinterpret_cast<__m128i const *>(a + i)), needle);
+            if (mask) {
+                return i + count_trailing_zeros(mask) / sizeof(T);
+            }
+        }
+        return i + find_scalar(a + i, n - i, value);
+    }
+
+    template<typename T>
+    __attribute__((target("avx2"))) size_t find_avx2(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 32 / sizeof(T);
+        __m128i half = splat_sse2(value);
+        __m256i needle = _mm256_broadcastsi128_si256(half);
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            unsigned mask = equal_mask_avx2<sizeof(T)>(
+                    _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i)), needle);
+            if (mask) {
+                return i + count_trailing_zeros(mask) / sizeof(T);
+            }
+        }
+        return i + find_scalar(a + i, n - i, value);
+    }
+
+    template<typename T>
+    size_t count_sse2(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 16 / sizeof(T);
+        __m128i needle = splat_sse2(value);
+        size_t matching_bytes = 0;
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            unsigned mask = equal_mask_sse2<sizeof(T)>(_mm_loadu_si128(reinterpret_cast<__m128i const *>(a + i)), needle);
+            matching_bytes += __builtin_popcount(mask);
+        }
+        return matching_bytes / sizeof(T) + count_scalar(a + i, n - i, value);
+    }
+
+    template<typename T>
+    __attribute__((target("avx2"))) size_t count_avx2(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 32 / sizeof(T);
+        __m256i needle = _mm256_broadcastsi128_si256(splat_sse2(value));
+        size_t matching_bytes = 0;
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            unsigned mask = equal_mask_avx2<sizeof(T)>(
+                    _mm256_loadu_si256(reinterpret_cast<__m256i const *>(a + i)), needle);
+            matching_bytes += __builtin_popcount(mask);
+        }
+        return matching_bytes / sizeof(T) + count_scalar(a + i, n - i, value);
+    }
+
+    inline size_t mismatch_bytes(unsigned char const *a, unsigned char const *b, size_t n) noexcept {
+        return has_avx2() ? mismatch_bytes_avx2(a, b, n) : mismatch_bytes_sse2(a, b, n);
+    }
+
+    template<typename T>
+    size_t find_lanes(T const *a, size_t n, T value) noexcept {
+        return has_avx2() ? find_avx2(a, n, value) : find_sse2(a, n, value);
+    }
+
+    template<typename T>
+    size_t count_lanes(T const *a, size_t n, T value) noexcept {
+        return has_avx2() ? count_avx2(a, n, value) : count_sse2(a, n, value);
+    }
+
+#elif VECTOR_SIMD_NEON
+    // NEON has no movemask: a block with a hit is rescanned with scalar code
+
+    template<typename T>
+    uint8x16_t equal_lanes_neon(uint8x16_t x, uint8x16_t y) noexcept {
+        if constexpr (sizeof(T) == 1) {
+            return vceqq_u8(x, y);
+        } else if constexpr (sizeof(T) == 2) {
+            return vreinterpretq_u8_u16(vceqq_u16(vreinterpretq_u16_u8(x), vreinterpretq_u16_u8(y)));
+        } else if constexpr (sizeof(T) == 4) {
+            return vreinterpretq_u8_u32(vceqq_u32(vreinterpretq_u32_u8(x), vreinterpretq_u32_u8(y)));
+        } else {
+            return vreinterpretq_u8_u64(vceqq_u64(vreinterpretq_u64_u8(x), vreinterpretq_u64_u8(y)));
+        }
+    }
+
+    template<typename T>
+    uint8x16_t splat_neon(T value) noexcept {
+        unsigned char bytes[16];
+        for (size_t i = 0; i != 16; i += sizeof(T)) {
+            std::memcpy(bytes + i, &value, sizeof(T));
+        }
+        return vld1q_u8(bytes);
+    }
+
+    inline size_t mismatch_bytes(unsigned char const *a, unsigned char const *b, size_t n) noexcept {
+        size_t i = 0;
+        for (; i + 16 <= n; i += 16) {
+            if (vminvq_u8(vceqq_u8(vld1q_u8(a + i), vld1q_u8(b + i))) != 0xff) {
+                break;
+            }
+        }
+        return i + mismatch_scalar(a + i, b + i, n - i);
+    }
+
+    template<typename T>
+    size_t find_lanes(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 16 / sizeof(T);
+        uint8x16_t needle = splat_neon(value);
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            uint8x16_t block = vld1q_u8(reinterpret_cast<unsigned char const *>(a + i));
+            if (vmaxvq_u8(equal_lanes_neon<T>(block, needle)) != 0) {
+                break;
+            }
+        }
+        return i + find_scalar(a + i, n - i, value);
+    }
+
+    template<typename T>
+    size_t count_lanes(T const *a, size_t n, T value) noexcept {
+        constexpr size_t lanes = 16 / sizeof(T);
+        uint8x16_t needle = splat_neon(value);
+        size_t matching_bytes = 0;
+        size_t i = 0;
+        for (; i + lanes <= n; i += lanes) {
+            uint8x16_t block = vld1q_u8(reinterpret_cast<unsigned char const *>(a + i));
+            // equal lanes are 0xff bytes, so one bit per byte adds up to sizeof(T) per match
+            matching_bytes += vaddvq_u8(vshrq_n_u8(equal_lanes_neon<T>(block, needle), 7));
+        }
+        return matching_bytes / sizeof(T) + count_scalar(a + i, n - i, value);
+    }
+
+#else
+
+    inline size_t mismatch_bytes(unsigned char const *a, unsigned char const *b, size_t n) noexcept {
+        return mismatch_scalar(a, b, n);
+    }
+
+    template<typename T>
+    size_t find_lanes(T const *a, size_t n, T value) noexcept {
+        return find_scalar(a, n, value);
+    }
+
+    template<typename T>
+    size_t count_lanes(T const *a, size_t n, T value) noexcept {
+        return count_scalar(a, n, value);
+    }
+
+#endif
+
+    template<typename T>
+    constexpr bool has_lanes = is_trivially_comparable<T>::value &&
+                               (sizeof(T) == 1 || sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8);
+
+    template<typename T>
+    bool equal(T const *a, T const *b, size_t n) {
+        if constexpr (is_trivially_comparable<T>::value) {
+            // libc's memcmp is already vectorized and dispatched at run time
+            return n == 0 || std::memcmp(a, b, n * sizeof(T)) == 0;
+        } else {
+            return std::equal(a, a + n, b);
+        }
+    }
+
+    template<typename T>
+    size_t mismatch(T const *a, T const *b, size_t n) {
+        if constexpr (is_trivially_comparable<T>::value) {
+            if (n == 0) {
+                return 0;
+            }
+            return mismatch_bytes(reinterpret_cast<unsigned char const *>(a),
+                                  reinterpret_cast<unsigned char const *>(b), n * sizeof(T)) / sizeof(T);
+        } else {
+            return mismatch_scalar(a, b, n);
+        }
+    }
+
+    template<typename T>
+    bool lexicographical_less(T const *a, size_t na, T const *b, size_t nb) {
+        if constexpr (is_trivially_comparable<T>::value) {
+            size_t n = std::min(na, nb);
+            size_t i = mismatch(a, b, n);
+            return i == n ? na < nb : a[i] < b[i];
+        } else {
+            return std::lexicographical_compare(a, a + na, b, b + nb);
+        }
+    }
+
+    template<typename T>
+    size_t find(T const *a, size_t n, T const &value) {
+        if constexpr (has_lanes<T>) {
+            return n == 0 ? 0 : find_lanes(a, n, value);
+        } else {
+            return std::find(a, a + n, value) - a;
+        }
+    }
+
+    template<typename T>
+    size_t count(T const *a, size_t n, T const &value) {
+        if constexpr (has_lanes<T>) {
+            return n == 0 ? 0 : count_lanes(a, n, value);
+        } else {
+            return std::count(a, a + n, value);
+        }
+    }
+}
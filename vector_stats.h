@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <initializer_list>
+
+#include "vector_detach_profile.h"
+
+// Per element type counters of the work vectors do behind the caller's back:
+// heap blocks, reallocations, COW detaches and the element copies and moves
+// these cost (memcpy relocation counts as moves). Define VECTOR_STATS before
+// including vector.h to turn them on; otherwise every hook is an empty inline
+// function and snapshot() returns zeros. Detaches also go to
+// vector_detach_profile, which has its own switch. Either switch changes the
+// definition of vector_stats<T> and of the vector members that call it, so it
+// must agree across every translation unit of a program: set it on the compiler
+// command line, not in one source file. Translation units that disagree break the
+// one-definition rule, with no diagnostic.
+struct vector_stats_snapshot {
+    size_t allocations = 0;
+    size_t deallocations = 0;
+    size_t bytes_allocated = 0;
+    size_t bytes_deallocated = 0;
+    size_t reallocations = 0;
+    size_t detaches = 0;
+    size_t copies = 0;
+    size_t moves = 0;
+    size_t peak_capacity = 0;
+
+    size_t live_bytes() const noexcept {
+        return bytes_allocated - bytes_deallocated;
+    }
+};
+
+#ifdef VECTOR_STATS
+
+template<typename T>
+struct vector_stats {
+    static constexpr bool enabled = true;
+
+    static void on_allocate(size_t bytes, size_t capacity) noexcept {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        bytes_allocated_.fetch_add(bytes, std::memory_order_relaxed);
+        size_t peak = peak_capacity_.load(std::memory_order_relaxed);
+        while (peak < capacity && !peak_capacity_.compare_exchange_weak(peak, capacity, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void on_deallocate(size_t bytes) noexcept {
+        deallocations_.fetch_add(1, std::memory_order_relaxed);
+        bytes_deallocated_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    static void on_reallocate() noexcept {
+        reallocations_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void on_detach(size_t bytes) noexcept {
+        detaches_.fetch_add(1, std::memory_order_relaxed);
+        vector_detach_profile::record(bytes);
+    }
+
+    static void on_copy(size_t n) noexcept {
+        copies_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    static void on_move(size_t n) noexcept {
+        moves_.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    // Counters are read one by one, so a snapshot taken under concurrent use is not atomic as a whole
+    static vector_stats_snapshot snapshot() noexcept {
+        vector_stats_snapshot s;
+        s.allocations = allocations_.load(std::memory_order_relaxed);
+        s.deallocations = deallocations_.load(std::memory_order_relaxed);
+        s.bytes_allocated = bytes_allocated_.load(std::memory_order_relaxed);
+        s.bytes_deallocated = bytes_deallocated_.load(std::memory_order_relaxed);
+        s.reallocations = reallocations_.load(std::memory_order_relaxed);
+        s.detaches = detaches_.load(std::memory_order_relaxed);
+        s.copies = copies_.load(std::memory_order_relaxed);
+        s.moves = moves_.load(std::memory_order_relaxed);
+        s.peak_capacity = peak_capacity_.load(std::memory_order_relaxed);
+        return s;
+    }
+
+    static void reset() noexcept {
+        for (std::atomic<size_t> *c : {&allocations_, &deallocations_, &bytes_allocated_, &bytes_deallocated_,
+                                       &reallocations_, &detaches_, &copies_, &moves_, &peak_capacity_}) {
+            c->store(0, std::memory_order_relaxed);
+        }
+    }
+
+private:
+    static inline std::atomic<size_t> allocations_{0};
+    static inline std::atomic<size_t> deallocations_{0};
+    static inline std::atomic<size_t> bytes_allocated_{0};
+    static inline std::atomic<size_t> bytes_deallocated_{0};
+    static inline std::atomic<size_t> reallocations_{0};
+    static inline std::atomic<size_t> detaches_{0};
+    static inline std::atomic<size_t> copies_{0};
+    static inline std::atomic<size_t> moves_{0};
+    static inline std::atomic<size_t> peak_capacity_{0};
+};
+
+#else
+
+template<typename T>
+struct vector_stats {
+    static constexpr bool enabled = false;
+
+    static void on_allocate(size_t, size_t) noexcept {}
+
+    static void on_deallocate(size_t) noexcept {}
+
+    static void on_reallocate() noexcept {}
+
+    static void on_detach(size_t bytes) noexcept {
+        vector_detach_profile::record(bytes);
+    }
+
+    static void on_copy(size_t) noexcept {}
+
+    static void on_move(size_t) noexcept {}
+
+    static vector_stats_snapshot snapshot() noexcept {
+        return vector_stats_snapshot();
+    }
+
+    static void reset() noexcept {}
+};
+
+#endif
@@ -1,7 +1,36 @@
+// The only translation unit of vector_testing that includes vector.h, so the
+// switch holds program-wide
+#define VECTOR_STATS
+
 #include <gtest/gtest.h>
 #include "fault_injection.h"
 #include "counted.h"
+#include "flat_map.h"
 #include "vector.h"
+#include "arena_allocator.h"
+#include "concurrent_vector.h"
+#include "incremental_vector.h"
+#include "large_block_allocator.h"
+#include "malloc_allocator.h"
+#include "mapped_file_allocator.h"
+#include "numa_allocator.h"
+#include "packed_vector.h"
+#include "persistent_vector.h"
+#include "segmented_vector.h"
+#include "soa_vector.h"
+#include "static_vector.h"
+#include "vector_parallel.h"
+#include "vector_serialization.h"
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 typedef vector<counted> container;
 //typedef std::vector<int> container_int;
 
@@ -972,6 +1001,2212 @@ TEST(correctness, swap_non_empty_non_empty)
     });
 }
 
+TEST(correctness, move_ctor)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.push_back(1);
+        c.push_back(2);
+        c.push_back(3);
+        counted const* old_data = c.data();
+
+        container d = std::move(c);
+        EXPECT_EQ(old_data, static_cast<container const&>(d).data());
+        EXPECT_EQ(3u, d.size());
+        EXPECT_EQ(1, d[0]);
+        EXPECT_EQ(2, d[1]);
+        EXPECT_EQ(3, d[2]);
+        EXPECT_TRUE(c.empty());
+    });
+}
+
+TEST(correctness, move_ctor_single)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.push_back(5);
+        container d = std::move(c);
+        EXPECT_EQ(1u, d.size());
+        EXPECT_EQ(5, d[0]);
+        EXPECT_TRUE(c.empty());
+    });
+}
+
+TEST(correctness, move_assignment)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.push_back(1);
+        c.push_back(2);
+        c.push_back(3);
+        container d;
+        d.push_back(4);
+        d.push_back(5);
+        container e = d;
+
+        d = std::move(c);
+        EXPECT_EQ(3u, d.size());
+        EXPECT_EQ(1, d[0]);
+        EXPECT_EQ(3, d[2]);
+        EXPECT_TRUE(c.empty());
+        EXPECT_EQ(2u, e.size());
+        EXPECT_EQ(4, e[0]);
+        EXPECT_EQ(5, e[1]);
+
+        d = std::move(d);
+        EXPECT_EQ(3u, d.size());
+    });
+}
+
+TEST(correctness, push_back_rvalue)
+{
+    vector<std::string> c;
+    std::string s(100, 'a');
+    c.push_back(std::move(s));
+    EXPECT_TRUE(s.empty());
+    for (size_t i = 0; i != 10; ++i)
+        c.push_back(std::string(100, 'b'));
+    EXPECT_EQ(11u, c.size());
+    EXPECT_EQ(std::string(100, 'a'), c[0]);
+    EXPECT_EQ(std::string(100, 'b'), c[10]);
+}
+
+TEST(correctness, emplace_back)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        for (size_t i = 0; i != 10; ++i)
+        {
+            counted& ref = c.emplace_back(static_cast<int>(i) * 2);
+            EXPECT_EQ(static_cast<int>(i) * 2, ref);
+        }
+        EXPECT_EQ(10u, c.size());
+        for (size_t i = 0; i != 10; ++i)
+            EXPECT_EQ(static_cast<int>(i) * 2, c[i]);
+    });
+}
+
+TEST(correctness, emplace_back_element_of_itself_single)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.emplace_back(7);
+        c.emplace_back(c[0]);
+        EXPECT_EQ(2u, c.size());
+        EXPECT_EQ(7, c[0]);
+        EXPECT_EQ(7, c[1]);
+    });
+}
+
+TEST(correctness, emplace)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.emplace(c.begin(), 2);
+        c.emplace(c.begin(), 1);
+        c.emplace(c.end(), 4);
+        c.emplace(c.begin() + 2, 3);
+        EXPECT_EQ(4u, c.size());
+        for (size_t i = 0; i != 4; ++i)
+            EXPECT_EQ(static_cast<int>(i) + 1, c[i]);
+    });
+}
+
+namespace
+{
+    struct copy_tracker
+    {
+        static size_t copies;
+        static size_t moves;
+
+        copy_tracker(int value) : value(value) {}
+        copy_tracker(copy_tracker const& other) : value(other.value) { ++copies; }
+        copy_tracker(copy_tracker&& other) noexcept : value(other.value) { ++moves; }
+        copy_tracker& operator=(copy_tracker const& other) { value = other.value; ++copies; return *this; }
+        copy_tracker& operator=(copy_tracker&& other) noexcept { value = other.value; ++moves; return *this; }
+
+        static void reset() { copies = moves = 0; }
+
+        int value;
+    };
+
+    size_t copy_tracker::copies = 0;
+    size_t copy_tracker::moves = 0;
+
+    struct relocatable_tracker : copy_tracker
+    {
+        using copy_tracker::copy_tracker;
+    };
+}
+
+template <>
+struct is_trivially_relocatable<relocatable_tracker> : std::true_type {};
+
+TEST(correctness, growth_moves_unique)
+{
+    vector<copy_tracker> c;
+    copy_tracker::reset();
+    for (int i = 0; i != 100; ++i)
+        c.push_back(i);
+    EXPECT_EQ(0u, copy_tracker::copies);
+    for (int i = 0; i != 100; ++i)
+        EXPECT_EQ(i, c[i].value);
+}
+
+TEST(correctness, growth_copies_shared)
+{
+    vector<copy_tracker> c;
+    for (int i = 0; i != 10; ++i)
+        c.push_back(i);
+    vector<copy_tracker> const d = c;
+    copy_tracker::reset();
+    c.reserve(100);
+    EXPECT_EQ(10u, copy_tracker::copies);
+    EXPECT_EQ(0u, copy_tracker::moves);
+    for (int i = 0; i != 10; ++i)
+    {
+        EXPECT_EQ(i, c[i].value);
+        EXPECT_EQ(i, d[i].value);
+    }
+}
+
+TEST(correctness, growth_relocates_trivially_relocatable)
+{
+    vector<relocatable_tracker> c;
+    for (int i = 0; i != 100; ++i)
+        c.push_back(i);
+    copy_tracker::reset();
+    c.reserve(1000);
+    EXPECT_EQ(0u, copy_tracker::copies);
+    EXPECT_EQ(0u, copy_tracker::moves);
+    c.insert(c.begin() + 50, -1);
+    copy_tracker::reset();
+    c.shrink_to_fit();
+    EXPECT_EQ(0u, copy_tracker::copies);
+    EXPECT_EQ(0u, copy_tracker::moves);
+    EXPECT_EQ(101u, c.size());
+    EXPECT_EQ(-1, c[50].value);
+    EXPECT_EQ(99, c[100].value);
+}
+
+TEST(correctness, resize_element_of_itself)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.push_back(1);
+        c.push_back(2);
+        c.resize(10, c[1]);
+        EXPECT_EQ(10u, c.size());
+        EXPECT_EQ(1, c[0]);
+        for (size_t i = 1; i != 10; ++i)
+            EXPECT_EQ(2, c[i]);
+    });
+}
+
+typedef small_vector<counted, 4> container_small;
+
+TEST(correctness, small_buffer_inline)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c;
+        EXPECT_EQ(4u, c.capacity());
+        char const* self = reinterpret_cast<char const*>(&c);
+        for (int i = 0; i != 4; ++i)
+            c.push_back(i);
+        char const* data = reinterpret_cast<char const*>(c.data());
+        EXPECT_TRUE(data >= self && data < self + sizeof(c));
+        EXPECT_EQ(4u, c.capacity());
+
+        c.push_back(4);
+        EXPECT_EQ(5u, c.size());
+        EXPECT_LE(5u, c.capacity());
+        for (int i = 0; i != 5; ++i)
+            EXPECT_EQ(i, c[i]);
+    });
+}
+
+TEST(correctness, small_buffer_copy_swap)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c, c2;
+        c.push_back(1);
+        c.push_back(2);
+        for (int i = 0; i != 10; ++i)
+            c2.push_back(i);
+
+        container_small d = c;
+        d[0] = 10;
+        EXPECT_EQ(1, c[0]);
+
+        swap(c, c2);
+        EXPECT_EQ(10u, c.size());
+        EXPECT_EQ(2u, c2.size());
+        EXPECT_EQ(9, c[9]);
+        EXPECT_EQ(2, c2[1]);
+
+        container_small e = std::move(c2);
+        EXPECT_EQ(2u, e.size());
+        EXPECT_TRUE(c2.empty());
+        c2 = e;
+        EXPECT_TRUE(c2 == e);
+    });
+}
+
+TEST(correctness, small_buffer_insert_erase)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c;
+        c.insert(c.begin(), 3);
+        c.insert(c.begin(), 1);
+        c.insert(c.begin() + 1, 2);
+        EXPECT_EQ(3u, c.size());
+        for (int i = 0; i != 3; ++i)
+            EXPECT_EQ(i + 1, c[i]);
+
+        c.erase(c.begin() + 1);
+        EXPECT_EQ(2u, c.size());
+        EXPECT_EQ(1, c[0]);
+        EXPECT_EQ(3, c[1]);
+
+        c.insert(c.begin() + 1, c[1]);
+        c.insert(c.begin() + 1, c[0]);
+        c.insert(c.begin(), c[3]);
+        EXPECT_EQ(5u, c.size());
+        EXPECT_EQ(3, c[0]);
+        EXPECT_EQ(1, c[1]);
+        EXPECT_EQ(1, c[2]);
+        EXPECT_EQ(3, c[3]);
+        EXPECT_EQ(3, c[4]);
+    });
+}
+
+TEST(correctness, small_buffer_resize)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c;
+        c.resize(3, 7);
+        EXPECT_EQ(3u, c.size());
+        EXPECT_EQ(7, c[2]);
+        c.resize(1, 0);
+        EXPECT_EQ(1u, c.size());
+        c.resize(10, c[0]);
+        EXPECT_EQ(10u, c.size());
+        for (size_t i = 0; i != 10; ++i)
+            EXPECT_EQ(7, c[i]);
+        c.clear();
+        EXPECT_TRUE(c.empty());
+    });
+}
+
+TEST(correctness, iterator_ctor)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        std::vector<int> src = {1, 2, 3, 4, 5, 6};
+        container c(src.begin(), src.end());
+        container_small d(src.begin(), src.begin() + 3);
+        EXPECT_EQ(6u, c.size());
+        EXPECT_EQ(3u, d.size());
+        for (size_t i = 0; i != 6; ++i)
+            EXPECT_EQ(src[i], c[i]);
+        for (size_t i = 0; i != 3; ++i)
+            EXPECT_EQ(src[i], d[i]);
+    });
+}
+
+TEST(correctness, compact_layout)
+{
+    EXPECT_EQ(2 * sizeof(void*), sizeof(vector<int>));
+    EXPECT_EQ(2 * sizeof(void*), sizeof(vector<void*>));
+    EXPECT_EQ(sizeof(size_t) + 4 * sizeof(int), sizeof(small_vector<int, 4>));
+}
+
+TEST(correctness, shrink_to_fit_inline)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c;
+        for (int i = 0; i != 10; ++i)
+            c.push_back(i);
+        container_small d = c;
+        c.erase(c.begin() + 3, c.end());
+        c.shrink_to_fit();
+        EXPECT_EQ(4u, c.capacity());
+        EXPECT_EQ(3u, c.size());
+        for (int i = 0; i != 3; ++i)
+            EXPECT_EQ(i, c[i]);
+        EXPECT_EQ(10u, d.size());
+
+        d.clear();
+        d.shrink_to_fit();
+        EXPECT_TRUE(d.empty());
+        EXPECT_EQ(4u, d.capacity());
+        d.push_back(1);
+        EXPECT_EQ(1, d[0]);
+    });
+}
+
+TEST(correctness, unchecked_at_no_detach)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        for (int i = 0; i != 5; ++i)
+            c.push_back(i);
+        container d = c;
+        int sum = 0;
+        for (size_t i = 0; i != d.size(); ++i)
+            sum += d.unchecked_at(i);
+        EXPECT_EQ(10, sum);
+        EXPECT_EQ(static_cast<container const&>(c).data(), static_cast<container const&>(d).data());
+    });
+}
+
+TEST(correctness, checked_at)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        c.push_back(1);
+        c.push_back(2);
+        EXPECT_EQ(2, c.checked_at(1));
+        container const& cc = c;
+        EXPECT_EQ(1, cc.checked_at(0));
+        // injected_fault is a runtime_error too, so it must not reach EXPECT_THROW
+        fault_injection_disable fd;
+        EXPECT_THROW(c.checked_at(2), std::runtime_error);
+        EXPECT_THROW(cc.checked_at(5), std::runtime_error);
+    });
+}
+
+TEST(correctness, mutable_span)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        for (int i = 0; i != 5; ++i)
+            c.push_back(i);
+        container d = c;
+        span<counted> s = d.mutable_span();
+        EXPECT_EQ(5u, s.size());
+        for (counted& x : s)
+            x = 42;
+        for (size_t i = 0; i != 5; ++i)
+        {
+            EXPECT_EQ(static_cast<int>(i), c[i]);
+            EXPECT_EQ(42, d[i]);
+        }
+        span<counted const> cs = c.const_span();
+        EXPECT_EQ(static_cast<container const&>(c).data(), cs.data());
+        EXPECT_EQ(5u, cs.size());
+    });
+}
+
+TEST(correctness, atomic_ref_count_threads)
+{
+    typedef vector<int, 1, atomic_ref_count> container_atomic;
+    container_atomic c;
+    for (int i = 0; i != 100; ++i)
+        c.push_back(i);
+
+    std::vector<std::thread> threads;
+    for (int t = 0; t != 4; ++t)
+    {
+        threads.emplace_back([&c, t]
+        {
+            container_atomic const& shared = c;
+            for (int round = 0; round != 1000; ++round)
+            {
+                container_atomic copy = shared;
+                if (round % 10 == 0)
+                    copy[0] = t;
+                container_atomic copy2 = copy;
+                EXPECT_EQ(99, copy2[99]);
+            }
+        });
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+
+    for (int i = 0; i != 100; ++i)
+        EXPECT_EQ(i, c[i]);
+}
+
+namespace
+{
+    struct allocation_log
+    {
+        size_t allocations = 0;
+        size_t deallocations = 0;
+        size_t live_bytes = 0;
+    };
+
+    template <typename T>
+    struct logging_allocator
+    {
+        typedef T value_type;
+
+        logging_allocator(allocation_log& log) : log(&log) {}
+
+        template <typename U>
+        logging_allocator(logging_allocator<U> const& other) : log(other.log) {}
+
+        T* allocate(size_t n)
+        {
+            ++log->allocations;
+            log->live_bytes += n * sizeof(T);
+            return std::allocator<T>().allocate(n);
+        }
+
+        void deallocate(T* p, size_t n)
+        {
+            ++log->deallocations;
+            log->live_bytes -= n * sizeof(T);
+            std::allocator<T>().deallocate(p, n);
+        }
+
+        friend bool operator==(logging_allocator const& a, logging_allocator const& b) { return a.log == b.log; }
+        friend bool operator!=(logging_allocator const& a, logging_allocator const& b) { return a.log != b.log; }
+
+        allocation_log* log;
+    };
+}
+
+TEST(correctness, stateful_allocator)
+{
+    typedef vector<int, 1, plain_ref_count, logging_allocator<int>> logged_vector;
+    allocation_log log, other_log;
+    {
+        logged_vector c{logging_allocator<int>(log)};
+        for (int i = 0; i != 100; ++i)
+            c.push_back(i);
+        EXPECT_LT(0u, log.allocations);
+
+        logged_vector d = c;
+        EXPECT_EQ(static_cast<logged_vector const&>(c).data(), static_cast<logged_vector const&>(d).data());
+        EXPECT_TRUE(d.get_allocator() == c.get_allocator());
+
+        logged_vector e{logging_allocator<int>(other_log)};
+        e = c;
+        EXPECT_TRUE(e.get_allocator() == logging_allocator<int>(other_log));
+        EXPECT_EQ(1u, other_log.allocations);
+        EXPECT_TRUE(e == c);
+
+        logged_vector f{logging_allocator<int>(other_log)};
+        f = std::move(d);
+        EXPECT_TRUE(f.get_allocator() == logging_allocator<int>(other_log));
+        EXPECT_EQ(100u, f.size());
+        EXPECT_EQ(2u, other_log.allocations);
+        EXPECT_TRUE(d.empty());
+    }
+    EXPECT_EQ(log.allocations, log.deallocations);
+    EXPECT_EQ(0u, log.live_bytes);
+    EXPECT_EQ(other_log.allocations, other_log.deallocations);
+    EXPECT_EQ(0u, other_log.live_bytes);
+}
+
+TEST(correctness, arena_allocator)
+{
+    typedef vector<std::string, 1, plain_ref_count, arena_allocator<std::string>> arena_vector;
+    arena a(1024);
+    {
+        arena_vector c{arena_allocator<std::string>(a)};
+        for (int i = 0; i != 100; ++i)
+            c.push_back(std::to_string(i));
+        EXPECT_LT(100 * sizeof(std::string), a.bytes_allocated());
+
+        arena b;
+        arena_vector d{arena_allocator<std::string>(b)};
+        d = c;
+        EXPECT_NE(static_cast<arena_vector const&>(c).data(), static_cast<arena_vector const&>(d).data());
+        EXPECT_LE(100u * sizeof(std::string), b.bytes_allocated());
+        EXPECT_GT(200u * sizeof(std::string), b.bytes_allocated());
+        d[5] = "five";
+        EXPECT_EQ("5", c[5]);
+        EXPECT_EQ("five", d[5]);
+        EXPECT_EQ("99", d[99]);
+    }
+}
+
+template <typename Growth>
+static std::vector<size_t> capacity_steps(size_t elements)
+{
+    vector<int, 1, plain_ref_count, std::allocator<int>, Growth> c;
+    std::vector<size_t> steps;
+    for (size_t i = 0; i != elements; ++i)
+    {
+        c.push_back(static_cast<int>(i));
+        if (steps.empty() || steps.back() != c.capacity())
+            steps.push_back(c.capacity());
+    }
+    for (size_t i = 0; i != elements; ++i)
+        EXPECT_EQ(static_cast<int>(i), c[i]);
+    return steps;
+}
+
+TEST(correctness, growth_policies)
+{
+    EXPECT_EQ((std::vector<size_t>{1, 2, 4, 8, 16, 32}), capacity_steps<doubling_growth>(20));
+    EXPECT_EQ((std::vector<size_t>{1, 2, 3, 4, 6, 9, 13, 19, 28}), capacity_steps<one_and_half_growth>(20));
+    EXPECT_EQ((std::vector<size_t>{1, 3, 6, 10, 14, 18, 22}), capacity_steps<capped_growth<4>>(20));
+}
+
+TEST(correctness, allocate_at_least_rounding)
+{
+    vector<char, 1, plain_ref_count, malloc_allocator<char>> c;
+    c.reserve(100);
+    EXPECT_LE(100u, c.capacity());
+    for (size_t i = 0; i != c.capacity(); ++i)
+        c.push_back('a');
+    EXPECT_EQ(c.size(), c.capacity());
+    vector<char, 1, plain_ref_count, malloc_allocator<char>> d = c;
+    d.push_back('b');
+    EXPECT_EQ('b', d.back());
+    EXPECT_EQ('a', c.back());
+}
+
+TEST(correctness, insert_range)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        std::vector<int> src = {10, 11, 12};
+        container c;
+        c.insert(c.begin(), src.begin(), src.end());
+        c.insert(c.begin() + 1, src.begin(), src.begin() + 2);
+        c.insert(c.end(), src.begin(), src.begin());
+        container d = c;
+        c.insert(c.end(), src.begin(), src.end());
+        std::vector<int> expected = {10, 10, 11, 11, 12, 10, 11, 12};
+        EXPECT_EQ(expected.size(), c.size());
+        for (size_t i = 0; i != expected.size(); ++i)
+            EXPECT_EQ(expected[i], c[i]);
+        EXPECT_EQ(5u, d.size());
+    });
+}
+
+TEST(correctness, insert_range_single_allocation)
+{
+    typedef vector<int, 1, plain_ref_count, logging_allocator<int>> logged_vector;
+    allocation_log log;
+    logged_vector c{logging_allocator<int>(log)};
+    c.reserve(10);
+    for (int i = 0; i != 10; ++i)
+        c.push_back(i);
+    std::vector<int> src(1000, 7);
+    size_t before = log.allocations;
+    c.insert(c.begin() + 5, src.begin(), src.end());
+    EXPECT_EQ(before + 1, log.allocations);
+    EXPECT_EQ(1010u, c.size());
+    EXPECT_EQ(4, c[4]);
+    EXPECT_EQ(7, c[5]);
+    EXPECT_EQ(7, c[1004]);
+    EXPECT_EQ(5, c[1005]);
+    EXPECT_EQ(9, c[1009]);
+}
+
+TEST(correctness, insert_fill)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container_small c;
+        c.push_back(1);
+        c.push_back(2);
+        c.insert(c.begin() + 1, 2, 5);
+        EXPECT_EQ(4u, c.size());
+        c.insert(c.begin(), 3, c[3]);
+        std::vector<int> expected = {2, 2, 2, 1, 5, 5, 2};
+        EXPECT_EQ(expected.size(), c.size());
+        for (size_t i = 0; i != expected.size(); ++i)
+            EXPECT_EQ(expected[i], c[i]);
+        c.insert(c.end(), 10, c[3]);
+        EXPECT_EQ(17u, c.size());
+        EXPECT_EQ(1, c[16]);
+    });
+}
+
+TEST(correctness, input_iterator_range)
+{
+    std::istringstream in("1 2 3 4 5");
+    container_int c{std::istream_iterator<int>(in), std::istream_iterator<int>()};
+    EXPECT_EQ(5u, c.size());
+    std::istringstream in2("7 8");
+    c.insert(c.begin() + 1, std::istream_iterator<int>(in2), std::istream_iterator<int>());
+    std::vector<int> expected = {1, 7, 8, 2, 3, 4, 5};
+    EXPECT_EQ(expected.size(), c.size());
+    for (size_t i = 0; i != expected.size(); ++i)
+        EXPECT_EQ(expected[i], c[i]);
+}
+
+TEST(correctness, initializer_list)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c = {1, 2, 3};
+        EXPECT_EQ(3u, c.size());
+        EXPECT_EQ(3, c[2]);
+        c = {4, 5};
+        EXPECT_EQ(2u, c.size());
+        EXPECT_EQ(4, c[0]);
+        c.insert(c.begin() + 1, {6, 7});
+        c.assign({8, 9, 10, 11});
+        EXPECT_EQ(4u, c.size());
+        EXPECT_EQ(11, c[3]);
+    });
+}
+
+TEST(correctness, append_range_and_fill_ctor)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c(4, 9);
+        EXPECT_EQ(4u, c.size());
+        EXPECT_EQ(9, c[3]);
+        std::vector<int> src = {1, 2, 3};
+        c.append_range(src);
+        EXPECT_EQ(7u, c.size());
+        EXPECT_EQ(9, c[3]);
+        EXPECT_EQ(3, c[6]);
+        container_int d(3, 2);
+        EXPECT_EQ(3u, d.size());
+        EXPECT_EQ(2, d[0]);
+    });
+}
+
+TEST(correctness, stats_growth)
+{
+    typedef vector<double> doubles;
+    vector_stats<double>::reset();
+    {
+        doubles c;
+        for (int i = 0; i != 100; ++i)
+            c.push_back(i);
+        vector_stats_snapshot s = vector_stats<double>::snapshot();
+        // spilling to the heap counts as the first reallocation; every later one frees the old block
+        EXPECT_EQ(s.allocations, s.reallocations);
+        EXPECT_EQ(s.allocations, s.deallocations + 1);
+        EXPECT_EQ(c.capacity(), s.peak_capacity);
+        EXPECT_LE(c.capacity() * sizeof(double), s.live_bytes());
+        EXPECT_EQ(0u, s.copies);
+        EXPECT_EQ(c.capacity() - 1, s.moves);  // 1 + 2 + 4 + ... + capacity / 2
+        EXPECT_EQ(0u, s.detaches);
+    }
+    EXPECT_EQ(0u, vector_stats<double>::snapshot().live_bytes());
+    vector_stats<double>::reset();
+    EXPECT_EQ(0u, vector_stats<double>::snapshot().allocations);
+}
+
+TEST(correctness, stats_detach)
+{
+    vector<std::string> a;
+    for (int i = 0; i != 10; ++i)
+        a.push_back(std::to_string(i));
+    vector_stats<std::string>::reset();
+    vector<std::string> b = a;
+    EXPECT_EQ(0u, vector_stats<std::string>::snapshot().allocations);
+    b[0] = "x";
+    b[1] = "y";
+    vector_stats_snapshot s = vector_stats<std::string>::snapshot();
+    EXPECT_EQ(1u, s.detaches);
+    EXPECT_EQ(10u, s.copies);
+    EXPECT_EQ(1u, s.allocations);
+    EXPECT_EQ(0u, s.reallocations);
+    EXPECT_EQ("0", a[0]);
+}
+
+namespace
+{
+    // Checks the vectorized paths against the standard algorithms for every length and hit position
+    template <typename T>
+    void check_simd_kernels()
+    {
+        for (size_t n = 0; n != 70; ++n)
+        {
+            std::vector<T> ref;
+            for (size_t i = 0; i != n; ++i)
+                ref.push_back(static_cast<T>(i % 5) - 2);
+            vector<T, 4> a(ref.begin(), ref.end());
+            for (T value : {T(-2), T(0), T(2), T(7)})
+            {
+                EXPECT_EQ(std::find(ref.begin(), ref.end(), value) - ref.begin(), a.find(value) - a.begin());
+                EXPECT_EQ(size_t(std::count(ref.begin(), ref.end(), value)), a.count(value));
+            }
+            for (size_t i = 0; i != n; ++i)
+            {
+                vector<T, 4> b(ref.begin(), ref.end());
+                EXPECT_TRUE(a == b);
+                b[i] = static_cast<T>(b[i] + 1);
+                EXPECT_FALSE(a == b);
+                EXPECT_TRUE(a < b);
+                b[i] = static_cast<T>(b[i] - 3);
+                EXPECT_TRUE(b < a);
+                EXPECT_FALSE(a < b);
+            }
+            vector<T, 4> longer(a);
+            longer.push_back(T(-1));
+            EXPECT_TRUE(a < longer);
+            EXPECT_FALSE(longer < a);
+        }
+    }
+}
+
+TEST(correctness, simd_kernels)
+{
+    check_simd_kernels<signed char>();
+    check_simd_kernels<short>();
+    check_simd_kernels<int>();
+    check_simd_kernels<long long>();
+}
+
+TEST(correctness, find_and_count_generic)
+{
+    vector<std::string> c = {"a", "b", "a", "c"};
+    EXPECT_EQ(c.begin() + 1, c.find("b"));
+    EXPECT_EQ(c.end(), c.find("z"));
+    EXPECT_EQ(2u, c.count("a"));
+    vector<std::string> d = {"a", "b", "a", "d"};
+    EXPECT_TRUE(c < d);
+    EXPECT_FALSE(c == d);
+}
+
+TEST(correctness, cached_hash)
+{
+    typedef vector<int> ints;
+    ints a;
+    for (int i = 0; i != 100; ++i)
+        a.push_back(i);
+    ints b = a;
+    size_t h = std::hash<ints>()(a);
+    EXPECT_EQ(h, b.hash());
+    EXPECT_EQ(h, ints(a.begin(), a.end()).hash());
+
+    b[5] = -1;
+    EXPECT_NE(h, b.hash());
+    EXPECT_FALSE(a == b);
+    b[5] = 5;
+    EXPECT_EQ(h, b.hash());
+    EXPECT_TRUE(a == b);
+
+    // writes to unshared storage must drop the cached value too
+    a.push_back(100);
+    EXPECT_NE(h, a.hash());
+    a.pop_back();
+    EXPECT_EQ(h, a.hash());
+    a.erase(a.begin());
+    a.insert(a.begin(), 0);
+    EXPECT_EQ(h, a.hash());
+    for (int& x : a.mutable_span())
+        x += 1;
+    EXPECT_NE(h, a.hash());
+}
+
+TEST(correctness, hash_after_write_through_old_span)
+{
+    typedef vector<int> ints;
+    ints a;
+    ints b;
+    for (int i = 0; i != 10; ++i)
+    {
+        a.push_back(i);
+        b.push_back(i == 9 ? 100 : i);
+    }
+    span<int> s = a.mutable_span();
+    int& first = a[0];
+    size_t ha = a.hash();
+    size_t hb = b.hash();
+    EXPECT_NE(ha, hb);
+    EXPECT_FALSE(a == b);
+    s[9] = 100;
+    EXPECT_TRUE(a == b);
+    EXPECT_EQ(hb, a.hash());
+    EXPECT_EQ(hb, std::hash<ints>()(a));
+    first = -1;
+    EXPECT_NE(hb, a.hash());
+
+    // sharing ends the window for writes through old views, so the hash caches again
+    first = 0;
+    ints c = a;
+    EXPECT_EQ(hb, c.hash());
+    EXPECT_TRUE(c == b);
+    std::unordered_set<ints> keys = {b};
+    EXPECT_EQ(1u, keys.count(a));
+}
+
+TEST(correctness, hash_inline_and_heap_agree)
+{
+    small_vector<int, 4> inline_rep = {1, 2, 3};
+    small_vector<int, 4> heap_rep;
+    heap_rep.reserve(10);
+    heap_rep.append_range(inline_rep);
+    EXPECT_EQ(inline_rep.hash(), heap_rep.hash());
+    EXPECT_EQ((small_vector<int, 4>().hash()), (vector<int, 4>(0, 0).hash()));
+
+    std::unordered_set<vector<int>> keys;
+    for (int i = 0; i != 50; ++i)
+        keys.insert(vector<int>(i % 10, i % 10));
+    EXPECT_EQ(10u, keys.size());
+    EXPECT_EQ(1u, keys.count(vector<int>(3, 3)));
+}
+
+TEST(correctness, slice_shares_storage)
+{
+    vector<int> c;
+    for (int i = 0; i != 100; ++i)
+        c.push_back(i);
+    vector<int>::slice_type window = c.slice(10, 20);
+    EXPECT_EQ(10u, window.size());
+    EXPECT_EQ(c.const_span().data() + 10, window.data());
+    // like vector itself, only the non-const operator[] detaches
+    vector<int>::slice_type const& view = window;
+    EXPECT_EQ(15, view[5]);
+    vector<int>::slice_type inner = window.slice(2, 4);
+    EXPECT_EQ(c.const_span().data() + 12, inner.data());
+    EXPECT_EQ(c.const_span().data() + 10, window.data());
+
+    window[0] = -1;
+    EXPECT_EQ(10, c[10]);
+    EXPECT_EQ(-1, window[0]);
+    EXPECT_EQ(12, inner[0]);
+
+    vector<int> copy = window.to_vector();
+    EXPECT_EQ(10u, copy.size());
+    EXPECT_EQ(-1, copy[0]);
+    EXPECT_EQ(19, copy[9]);
+    EXPECT_THROW(c.slice(5, 101), std::runtime_error);
+    EXPECT_THROW(window.slice(3, 2), std::runtime_error);
+    EXPECT_TRUE(c.slice(0, 0).empty());
+}
+
+TEST(correctness, slice_last_owner_writes_in_place)
+{
+    vector<std::string> c;
+    for (int i = 0; i != 10; ++i)
+        c.push_back(std::to_string(i));
+    vector<std::string>::slice_type window = c.slice(2, 5);
+    std::string const* before = window.data();
+    c = vector<std::string>();
+    window.mutable_span()[0] = "x";
+    EXPECT_EQ(before, window.data());
+    EXPECT_EQ("x", window[0]);
+    EXPECT_EQ("4", window[2]);
+
+    small_vector<int, 4> inline_rep = {1, 2, 3};
+    small_vector<int, 4>::slice_type part = inline_rep.slice(1, 3);
+    part[0] = 7;
+    EXPECT_EQ(2, inline_rep[1]);
+    EXPECT_EQ(7, part.to_vector()[0]);
+}
+
+TEST(correctness, subspan)
+{
+    vector<int> c = {1, 2, 3, 4, 5};
+    span<int const> tail = c.const_span().subspan(2, 3);
+    EXPECT_EQ(3u, tail.size());
+    EXPECT_EQ(3, tail[0]);
+    EXPECT_EQ(5, tail[2]);
+}
+
+TEST(correctness, resize_for_overwrite)
+{
+    vector<int> c = {1, 2, 3};
+    c.resize_for_overwrite(100);
+    EXPECT_EQ(100u, c.size());
+    EXPECT_EQ(3, c[2]);
+    c.resize_for_overwrite(2);
+    EXPECT_EQ(2u, c.size());
+    EXPECT_EQ(2, c[1]);
+
+    vector<std::string> strings(3, "a");
+    strings.resize_for_overwrite(5);
+    EXPECT_EQ("", strings[4]);
+    EXPECT_EQ("a", strings[2]);
+
+    vector<int> value_init = {7};
+    value_init.resize(4);
+    EXPECT_EQ(0, value_init[3]);
+}
+
+TEST(correctness, reserve_and_write)
+{
+    char const message[] = "hello, world";
+    vector<char> buffer;
+    size_t offset = 0;
+    // a reader that hands out at most 5 bytes per call
+    auto read_some = [&](char* dst, size_t n)
+    {
+        size_t k = std::min<size_t>({n, 5, sizeof(message) - 1 - offset});
+        std::memcpy(dst, message + offset, k);
+        offset += k;
+        return k;
+    };
+    while (buffer.reserve_and_write(64, read_some) != 0)
+    {
+    }
+    EXPECT_EQ(sizeof(message) - 1, buffer.size());
+    EXPECT_EQ(std::string(message), std::string(buffer.begin(), buffer.end()));
+
+    vector<char> shared = buffer;
+    EXPECT_EQ(2u, shared.reserve_and_write(2, [](char* dst, size_t)
+    {
+        dst[0] = '!';
+        dst[1] = '?';
+        return 2;
+    }));
+    EXPECT_EQ(sizeof(message) - 1, buffer.size());
+    EXPECT_EQ('?', shared.back());
+
+    EXPECT_THROW(shared.reserve_and_write(10, [](char*, size_t) -> size_t
+    {
+        throw std::runtime_error("read failed");
+    }), std::runtime_error);
+    EXPECT_EQ(sizeof(message) + 1, shared.size());
+}
+
+namespace
+{
+    typedef vector<int, 1, plain_ref_count, mapped_file_allocator<int>> mapped_ints;
+
+    struct temp_path
+    {
+        temp_path()
+        {
+            char name[] = "/tmp/vector_testing_XXXXXX";
+            int fd = mkstemp(name);
+            EXPECT_LE(0, fd);
+            close(fd);
+            path = name;
+        }
+
+        ~temp_path()
+        {
+            unlink(path.c_str());
+        }
+
+        std::string path;
+    };
+}
+
+TEST(correctness, mapped_file_roundtrip)
+{
+    temp_path tmp;
+    {
+        mapped_file file(tmp.path.c_str());
+        mapped_ints c(adopt_storage, file);
+        EXPECT_TRUE(c.empty());
+        for (int i = 0; i != 10000; ++i)
+            c.push_back(i);
+        EXPECT_LE(10000 * sizeof(int), file.file_size());
+        // copies live in ordinary memory
+        mapped_ints copy = c;
+        EXPECT_EQ(nullptr, copy.get_allocator().get_file());
+        copy[0] = -1;
+        EXPECT_EQ(0, c[0]);
+    }
+    {
+        mapped_file file(tmp.path.c_str());
+        mapped_ints c(adopt_storage, file);
+        EXPECT_EQ(10000u, c.size());
+        EXPECT_EQ(9999, c.back());
+        c.erase(c.begin() + 1, c.end());
+        c.shrink_to_fit();
+        EXPECT_EQ(1u, c.size());
+    }
+    {
+        mapped_file file(tmp.path.c_str());
+        mapped_ints c(adopt_storage, file);
+        EXPECT_EQ(1u, c.size());
+        EXPECT_EQ(0, c[0]);
+        EXPECT_GT(10000 * sizeof(int), file.file_size());
+    }
+}
+
+TEST(correctness, mapped_file_rejects_garbage)
+{
+    temp_path tmp;
+    {
+        std::FILE* f = std::fopen(tmp.path.c_str(), "wb");
+        std::fputs("not a vector", f);
+        std::fclose(f);
+    }
+    mapped_file file(tmp.path.c_str());
+    EXPECT_THROW(mapped_ints(adopt_storage, file), std::runtime_error);
+}
+
+TEST(correctness, reallocate_with_aliasing_arguments)
+{
+    // without a file the allocator reallocates with realloc
+    mapped_ints c;
+    for (int i = 0; i != 100; ++i)
+    {
+        c.push_back(i);
+        c.shrink_to_fit();
+        c.push_back(c[0]);
+        c.pop_back();
+    }
+    c.shrink_to_fit();
+    c.insert(c.begin(), 50, c[99]);
+    EXPECT_EQ(150u, c.size());
+    EXPECT_EQ(99, c[0]);
+    EXPECT_EQ(99, c[49]);
+    EXPECT_EQ(0, c[50]);
+    c.shrink_to_fit();
+    c.emplace(c.begin() + 1, c.back());
+    EXPECT_EQ(99, c[1]);
+    c.shrink_to_fit();
+    c.resize(300, c[51]);
+    EXPECT_EQ(0, c[299]);
+}
+
+TEST(correctness, large_block_growth)
+{
+    vector<int, 1, plain_ref_count, large_block_allocator<int, 4096>> c;
+    for (int i = 0; i != 1000000; ++i)
+        c.push_back(i);
+    EXPECT_EQ(999999, c.back());
+    EXPECT_EQ(123456, c[123456]);
+    c.erase(c.begin() + 100, c.end());
+    c.shrink_to_fit();
+    EXPECT_EQ(100u, c.size());
+    EXPECT_EQ(99, c.back());
+    c.insert(c.begin(), 2000, c[5]);
+    EXPECT_EQ(5, c[1999]);
+    EXPECT_EQ(0, c[2000]);
+
+    vector<std::string, 1, plain_ref_count, large_block_allocator<std::string, 4096,
+            large_block_hugetlb | large_block_populate>> strings;
+    for (int i = 0; i != 10000; ++i)
+        strings.push_back(std::to_string(i));
+    EXPECT_EQ("9999", strings.back());
+    strings.shrink_to_fit();
+    EXPECT_EQ("1234", strings[1234]);
+}
+
+TEST(correctness, serialize_roundtrip)
+{
+    temp_path tmp;
+    int fd = open(tmp.path.c_str(), O_RDWR | O_TRUNC);
+    ASSERT_LE(0, fd);
+    container_int ints;
+    for (int i = 0; i != 5000; ++i)
+        ints.push_back(i * 7);
+    container_int one;
+    one.push_back(42);
+    vector<std::string, 2> strings;
+    strings.push_back("");
+    strings.push_back("copy on write");
+    strings.push_back(std::string(1000, 'x'));
+    write_to(fd, ints);
+    write_to(fd, one);
+    write_to(fd, strings);
+    write_to(fd, container_int());
+
+    lseek(fd, 0, SEEK_SET);
+    EXPECT_EQ(ints, read_from<container_int>(fd));
+    EXPECT_EQ(one, read_from<container_int>(fd));
+    EXPECT_EQ(strings, (read_from<vector<std::string, 2>>(fd)));
+    EXPECT_TRUE(read_from<container_int>(fd).empty());
+    EXPECT_THROW(read_from<container_int>(fd), std::runtime_error);
+    close(fd);
+}
+
+TEST(correctness, serialize_rejects_bad_input)
+{
+    temp_path tmp;
+    int fd = open(tmp.path.c_str(), O_RDWR | O_TRUNC);
+    ASSERT_LE(0, fd);
+    container_int ints;
+    for (int i = 0; i != 100; ++i)
+        ints.push_back(i);
+    write_to(fd, ints);
+    std::vector<unsigned char> image(sizeof(serialized_header) + 100 * sizeof(int));
+    lseek(fd, 0, SEEK_SET);
+    ASSERT_EQ((ssize_t) image.size(), read(fd, image.data(), image.size()));
+
+    span<int const> view = view_serialized<int>(image.data(), image.size());
+    EXPECT_EQ(100u, view.size());
+    EXPECT_EQ(99, view[99]);
+    EXPECT_EQ(image.data() + sizeof(serialized_header), (unsigned char const*) view.data());
+    EXPECT_THROW(view_serialized<int>(image.data(), image.size() - 1), std::runtime_error);
+    EXPECT_THROW(view_serialized<long long>(image.data(), image.size()), std::runtime_error);
+
+    image.back() ^= 1;
+    EXPECT_THROW(view_serialized<int>(image.data(), image.size()), std::runtime_error);
+    lseek(fd, (off_t) image.size() - 1, SEEK_SET);
+    ASSERT_EQ(1, write(fd, &image.back(), 1));
+    lseek(fd, 0, SEEK_SET);
+    EXPECT_THROW(read_from<container_int>(fd), std::runtime_error);
+    lseek(fd, 0, SEEK_SET);
+    EXPECT_THROW(read_from<vector<std::string>>(fd), std::runtime_error);
+    close(fd);
+}
+
+TEST(correctness, parallel_copy_fill_resize)
+{
+    vector_parallel::thread_limit = 3;
+    size_t const n = 3 * vector_parallel::min_bytes_per_thread / sizeof(int) + 17;
+    container_int a;
+    parallel_resize(a, n, 7);
+    EXPECT_EQ(n, a.size());
+    EXPECT_EQ(7, a[0]);
+    EXPECT_EQ(7, a[n - 1]);
+    a[5] = 5;
+
+    container_int shared = a;
+    container_int copy = parallel_copy(a);
+    EXPECT_FALSE(copy.shared());
+    EXPECT_EQ(a, copy);
+    EXPECT_NE(a.const_span().data(), copy.const_span().data());
+
+    EXPECT_TRUE(shared.shared());
+    parallel_detach(shared);
+    EXPECT_FALSE(shared.shared());
+    EXPECT_FALSE(a.shared());
+    EXPECT_EQ(a, shared);
+
+    container_int b = a;
+    parallel_fill(b, 3);
+    EXPECT_EQ(5, a[5]);
+    EXPECT_EQ(3, b[5]);
+    EXPECT_EQ(3, b[n - 1]);
+    EXPECT_EQ(n, b.size());
+
+    parallel_resize(b, 2 * n, b[1]);
+    EXPECT_EQ(3, b[2 * n - 1]);
+    parallel_transform(b, [](int x) { return x + 1; });
+    EXPECT_EQ(4, b[0]);
+    EXPECT_EQ(4, b[2 * n - 1]);
+    // the value may be one of the elements being overwritten
+    b[n] = 9;
+    parallel_fill(b, std::as_const(b)[n]);
+    EXPECT_EQ((std::ptrdiff_t) (2 * n), std::count(b.begin(), b.end(), 9));
+
+    container_int c = parallel_construct<container_int>(a.begin(), a.begin() + 3);
+    EXPECT_EQ(3u, c.size());
+    EXPECT_EQ(7, c[2]);
+
+    vector<std::string> strings;
+    parallel_resize(strings, 1000, std::string("x"));
+    parallel_transform(strings, [](std::string const& s) { return s + "y"; });
+    EXPECT_EQ("xy", strings[999]);
+    vector_parallel::thread_limit = 0;
+}
+
+TEST(correctness, parallel_sort)
+{
+    vector_parallel::thread_limit = 4;
+    size_t const n = 4 * vector_parallel::min_bytes_per_thread / sizeof(int) + 3;
+    container_int a;
+    a.reserve(n);
+    unsigned x = 12345;
+    for (size_t i = 0; i != n; ++i)
+    {
+        x = x * 1103515245u + 12345u;
+        a.push_back((int) (x >> 8));
+    }
+    container_int original = a;
+    parallel_sort(a);
+    EXPECT_TRUE(std::is_sorted(a.begin(), a.end()));
+    std::vector<int> expected(original.begin(), original.end());
+    std::sort(expected.begin(), expected.end());
+    EXPECT_TRUE(std::equal(expected.begin(), expected.end(), a.begin(), a.end()));
+    EXPECT_FALSE(std::is_sorted(original.begin(), original.end()));
+
+    parallel_sort(a, std::greater<>());
+    EXPECT_TRUE(std::is_sorted(a.rbegin(), a.rend()));
+    int bad = expected[n / 2];
+    EXPECT_THROW(parallel_transform(a, [bad](int v) { if (v == bad) throw std::runtime_error("f"); return v; }),
+                 std::runtime_error);
+    vector_parallel::thread_limit = 0;
+}
+
+TEST(correctness, soa_columns)
+{
+    soa_vector<int, double, std::string> rows;
+    for (int i = 0; i != 100; ++i)
+        rows.push_back(i, i * 0.5, std::to_string(i));
+    EXPECT_EQ(100u, rows.size());
+    span<int const> ids = rows.column<0>();
+    EXPECT_EQ(99, ids[99]);
+    EXPECT_EQ(ids.data() + 1, &rows.column<0>()[1]);
+
+    soa_vector<int, double, std::string> const& crows = rows;
+    EXPECT_EQ("42", crows[42].get<2>());
+    std::tuple<int, double, std::string> row = crows[7];
+    EXPECT_EQ(std::make_tuple(7, 3.5, std::string("7")), row);
+
+    // a write copies only the column it touches
+    soa_vector<int, double, std::string> copy = rows;
+    copy[3].get<1>() = -1.0;
+    EXPECT_EQ(1.5, crows[3].get<1>());
+    EXPECT_EQ(-1.0, std::as_const(copy)[3].get<1>());
+    EXPECT_EQ(rows.column<0>().data(), copy.column<0>().data());
+    EXPECT_EQ(rows.column<2>().data(), copy.column<2>().data());
+    EXPECT_NE(rows.column<1>().data(), copy.column<1>().data());
+
+    copy[4] = std::make_tuple(0, 0.0, "zero");
+    EXPECT_EQ("zero", std::as_const(copy)[4].get<2>());
+    EXPECT_EQ("4", crows[4].get<2>());
+    EXPECT_NE(rows, copy);
+
+    span<int> mutable_ids = copy.mutable_column<0>();
+    for (int& id : mutable_ids)
+        id *= 2;
+    EXPECT_EQ(198, copy.column<0>()[99]);
+    EXPECT_EQ(99, rows.column<0>()[99]);
+
+    soa_vector<int, double, std::string> shorter = rows;
+    shorter.resize(10);
+    shorter.pop_back();
+    EXPECT_EQ(9u, shorter.size());
+    EXPECT_EQ(100u, rows.size());
+    EXPECT_EQ("8", std::as_const(shorter).back().get<2>());
+    shorter.resize(20);
+    EXPECT_EQ(0, std::as_const(shorter)[19].get<0>());
+    EXPECT_EQ("", std::as_const(shorter)[19].get<2>());
+}
+
+TEST(correctness, soa_push_back_is_atomic)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        soa_vector<counted, int, counted> rows;
+        for (int i = 0; i != 10; ++i)
+        {
+            size_t old_size = rows.size();
+            try
+            {
+                rows.push_back(i, i, -i);
+            }
+            catch (...)
+            {
+                EXPECT_EQ(old_size, rows.size());
+                EXPECT_EQ(old_size, rows.column<0>().size());
+                EXPECT_EQ(old_size, rows.column<1>().size());
+                EXPECT_EQ(old_size, rows.column<2>().size());
+                throw;
+            }
+        }
+        EXPECT_EQ(-9, (int) std::as_const(rows)[9].get<2>());
+    });
+}
+
+TEST(correctness, persistent_vector_versions)
+{
+    persistent_vector<int> v;
+    std::vector<int> model;
+    std::vector<persistent_vector<int>> versions;
+    std::vector<std::vector<int>> models;
+    unsigned x = 1;
+    for (int i = 0; i != 40000; ++i)
+    {
+        v.push_back(i);
+        model.push_back(i);
+        if (i % 997 == 0)
+        {
+            versions.push_back(v);
+            models.push_back(model);
+        }
+    }
+    for (int i = 0; i != 2000; ++i)
+    {
+        x = x * 1103515245u + 12345u;
+        size_t index = (x >> 8) % model.size();
+        v[index] = -i;
+        model[index] = -i;
+        if (i % 101 == 0)
+        {
+            versions.push_back(v);
+            models.push_back(model);
+        }
+    }
+    v.set(0, v[1]);
+    model[0] = model[1];
+    while (v.size() > 7)
+    {
+        v.pop_back();
+        model.pop_back();
+        if (v.size() % 4999 == 0)
+        {
+            versions.push_back(v);
+            models.push_back(model);
+        }
+    }
+    versions.push_back(v);
+    models.push_back(model);
+    for (size_t i = 0; i != versions.size(); ++i)
+    {
+        ASSERT_EQ(models[i].size(), versions[i].size());
+        EXPECT_TRUE(std::equal(models[i].begin(), models[i].end(), versions[i].begin(), versions[i].end()));
+    }
+    persistent_vector<int> copy = versions[3];
+    EXPECT_EQ(versions[3], copy);
+    copy[5] = 12345;
+    EXPECT_NE(versions[3], copy);
+    EXPECT_EQ(5, std::as_const(versions[3])[5]);
+
+    while (!v.empty())
+        v.pop_back();
+    EXPECT_THROW(v.pop_back(), std::runtime_error);
+    v.push_back(1);
+    EXPECT_EQ(1, v.back());
+}
+
+TEST(correctness, persistent_vector_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        persistent_vector<counted> v;
+        for (int i = 0; i != 70; ++i)
+            v.push_back(i);
+        persistent_vector<counted> snapshot = v;
+        try
+        {
+            v[3] = 33;
+            v.push_back(70);
+            v.pop_back();
+            v.pop_back();
+            v.pop_back();
+            v[66] = -66;
+        }
+        catch (...)
+        {
+            EXPECT_EQ(70u, snapshot.size());
+            for (int i = 0; i != 70; ++i)
+                EXPECT_EQ(i, (int) std::as_const(snapshot)[i]);
+            throw;
+        }
+        EXPECT_EQ(33, (int) std::as_const(v)[3]);
+        EXPECT_EQ(3, (int) std::as_const(snapshot)[3]);
+        EXPECT_EQ(68u, v.size());
+        EXPECT_EQ(-66, (int) std::as_const(v)[66]);
+        EXPECT_EQ(67, (int) std::as_const(v).back());
+    });
+}
+
+TEST(correctness, segmented_vector_stable_addresses)
+{
+    segmented_vector<int, 4> v;
+    v.push_back(0);
+    int const* first = &v[0];
+    std::vector<int const*> addresses;
+    for (int i = 1; i != 10000; ++i)
+    {
+        v.push_back(v[i - 1] + 1);
+        if (i % 1000 == 0)
+            addresses.push_back(&v[i]);
+    }
+    EXPECT_EQ(first, &v[0]);
+    for (size_t i = 0; i != addresses.size(); ++i)
+        EXPECT_EQ(addresses[i], &v[(i + 1) * 1000]);
+    EXPECT_EQ(10000u, v.size());
+    for (int i = 0; i != 10000; ++i)
+        ASSERT_EQ(i, v[i]);
+    EXPECT_EQ(9999, v.back());
+    EXPECT_TRUE(std::equal(v.begin(), v.end(), v.flatten().begin()));
+
+    size_t covered = 0;
+    v.for_each_segment([&](int const* seg, size_t n)
+    {
+        EXPECT_EQ((int) covered, seg[0]);
+        covered += n;
+    });
+    EXPECT_EQ(10000u, covered);
+
+    segmented_vector<int, 4> copy = v;
+    EXPECT_EQ(v, copy);
+    copy[5000] = -1;
+    EXPECT_NE(v, copy);
+    v.resize(10);
+    v.shrink_to_fit();
+    EXPECT_EQ(12u, v.capacity());
+    EXPECT_EQ(first, &v[0]);
+    v.resize(20, 7);
+    EXPECT_EQ(7, v[19]);
+    std::sort(copy.begin(), copy.end());
+    EXPECT_EQ(-1, copy.front());
+}
+
+TEST(correctness, segmented_vector_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        segmented_vector<counted, 2> v;
+        for (int i = 0; i != 20; ++i)
+            v.push_back(i);
+        segmented_vector<counted, 2> copy = v;
+        v.emplace_back(v[3]);
+        v.pop_back();
+        EXPECT_EQ(v, copy);
+        vector<counted> flat = v.flatten();
+        EXPECT_EQ(20u, flat.size());
+        EXPECT_EQ(19, (int) flat[19]);
+    });
+}
+
+namespace
+{
+    struct move_counter
+    {
+        static size_t moves;
+
+        int value;
+
+        move_counter(int value) : value(value) {}
+
+        move_counter(move_counter&& other) noexcept : value(other.value)
+        {
+            ++moves;
+        }
+
+        move_counter(move_counter const& other) : value(other.value)
+        {
+            ++moves;
+        }
+    };
+
+    size_t move_counter::moves = 0;
+
+    // Its move may throw, so migration copies, and the next failures copies do throw
+    struct flaky_copy
+    {
+        static size_t failures;
+
+        int value;
+
+        flaky_copy(int value) : value(value) {}
+
+        flaky_copy(flaky_copy&& other) : value(other.value) {}
+
+        flaky_copy(flaky_copy const& other) : value(other.value)
+        {
+            if (failures != 0)
+            {
+                --failures;
+                throw std::runtime_error("flaky_copy failed");
+            }
+        }
+    };
+
+    size_t flaky_copy::failures = 0;
+
+    // Pushes until the next push_back has to grow
+    void fill_incremental(incremental_vector<flaky_copy, 2>& v)
+    {
+        while (v.migrating() || v.size() != v.capacity())
+            v.emplace_back((int) v.size());
+    }
+
+    void check_incremental(incremental_vector<flaky_copy, 2> const& v)
+    {
+        for (size_t i = 0; i != v.size(); ++i)
+            ASSERT_EQ((int) i, v[i].value);
+    }
+}
+
+TEST(correctness, incremental_vector_bounded_growth)
+{
+    incremental_vector<move_counter> v;
+    bool saw_migration = false;
+    for (int i = 0; i != 100000; ++i)
+    {
+        move_counter::moves = 0;
+        v.emplace_back(i);
+        EXPECT_GE(3u, move_counter::moves);
+        saw_migration |= v.migrating();
+        if (i % 7919 == 0)
+        {
+            for (int j = 0; j <= i; j += 101)
+                ASSERT_EQ(j, v[j].value);
+        }
+    }
+    EXPECT_TRUE(saw_migration);
+    for (int i = 0; i != 100000; ++i)
+        ASSERT_EQ(i, v[i].value);
+
+    // one_and_half_growth leaves only (n - 1) / 2 free slots after an odd size n
+    typedef incremental_vector<move_counter, 0, std::allocator<move_counter>, one_and_half_growth> slow_growth;
+    static_assert(slow_growth::step == 3);
+    slow_growth slow;
+    for (int i = 0; i != 100000; ++i)
+    {
+        move_counter::moves = 0;
+        slow.emplace_back(i);
+        ASSERT_GE(3u, move_counter::moves);
+    }
+    for (int i = 0; i < 100000; i += 97)
+        ASSERT_EQ(i, slow[i].value);
+
+    incremental_vector<int> ints;
+    for (int i = 0; i != 1000; ++i)
+    {
+        ints.push_back(ints.empty() ? 0 : ints.back() + 1);
+        if (i % 3 == 0 && ints.migrating())
+            ints.pop_back();
+    }
+    for (size_t i = 0; i != ints.size(); ++i)
+        ASSERT_EQ((int) i, ints[i]);
+    incremental_vector<int> copy = ints;
+    EXPECT_FALSE(copy.migrating());
+    EXPECT_EQ(ints, copy);
+    ints.finish_migration();
+    EXPECT_FALSE(ints.migrating());
+    EXPECT_EQ(ints, copy);
+    EXPECT_TRUE(std::equal(copy.begin(), copy.end(), ints.begin()));
+}
+
+TEST(correctness, incremental_vector_exceptions)
+{
+    // Room up front keeps migration, which swallows its faults, out of the run
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        incremental_vector<counted> v;
+        v.reserve(40);
+        for (int i = 0; i != 40; ++i)
+        {
+            size_t old_size = v.size();
+            try
+            {
+                v.push_back(v.empty() ? counted(0) : v.back());
+            }
+            catch (...)
+            {
+                EXPECT_EQ(old_size, v.size());
+                throw;
+            }
+        }
+        for (int i = 0; i != 40; ++i)
+            EXPECT_EQ(0, (int) v[i]);
+        incremental_vector<counted> copy = v;
+        v.clear();
+        EXPECT_EQ(40u, copy.size());
+    });
+}
+
+TEST(correctness, incremental_vector_migration_retry)
+{
+    incremental_vector<flaky_copy, 2> v;
+    v.emplace_back(0);
+    fill_incremental(v);
+    size_t old_size = v.size();
+    flaky_copy::failures = 1;
+    v.emplace_back((int) v.size());
+    EXPECT_EQ(0u, flaky_copy::failures);
+    EXPECT_EQ(old_size + 1, v.size());
+    EXPECT_TRUE(v.migrating());
+    check_incremental(v);
+    // later calls retry the failed copy and catch up before the block fills
+    while (v.migrating() && v.size() != v.capacity())
+        v.emplace_back((int) v.size());
+    EXPECT_FALSE(v.migrating());
+    check_incremental(v);
+
+    fill_incremental(v);
+    flaky_copy::failures = 2;
+    v.emplace_back((int) v.size());
+    EXPECT_TRUE(v.migrating());
+    EXPECT_THROW(v.finish_migration(), std::runtime_error);
+    EXPECT_TRUE(v.migrating());
+    check_incremental(v);
+    v.finish_migration();
+    EXPECT_FALSE(v.migrating());
+    check_incremental(v);
+}
+
+TEST(correctness, erase_if_single_pass)
+{
+    container_int a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i);
+    container_int shared = a;
+    vector_stats<int>::reset();
+    size_t calls = 0;
+    EXPECT_EQ(500u, erase_if(shared, [&](int x) { ++calls; return x % 2 == 1; }));
+    EXPECT_EQ(1000u, calls);
+    vector_stats_snapshot s = vector_stats<int>::snapshot();
+    EXPECT_EQ(1u, s.detaches);
+    EXPECT_EQ(500u, s.copies);
+    EXPECT_EQ(500u, shared.size());
+    EXPECT_EQ(998, shared.back());
+    EXPECT_EQ(1000u, a.size());
+    EXPECT_EQ(999, a.back());
+
+    container_int copy = a;
+    EXPECT_EQ(0u, erase_if(copy, [](int x) { return x < 0; }));
+    EXPECT_TRUE(copy.shared());
+    EXPECT_EQ(10u, erase_if(a, [](int x) { return x >= 990; }));
+    EXPECT_EQ(990u, a.size());
+    EXPECT_EQ(1000u, copy.size());
+
+    small_vector<std::string, 4> small;
+    small.push_back("a");
+    small.push_back("bb");
+    small.push_back("c");
+    EXPECT_EQ(2u, erase_if(small, [](std::string const& x) { return x.size() == 1; }));
+    EXPECT_EQ(1u, small.size());
+    EXPECT_EQ("bb", small[0]);
+}
+
+TEST(correctness, remove_indices_and_swap_erase)
+{
+    container_int a;
+    for (int i = 0; i != 20; ++i)
+        a.push_back(i);
+    container_int shared = a;
+    std::vector<size_t> indices = {0, 3, 4, 19};
+    EXPECT_EQ(4u, shared.remove_indices(indices));
+    EXPECT_EQ(16u, shared.size());
+    EXPECT_EQ(1, shared[0]);
+    EXPECT_EQ(5, shared[2]);
+    EXPECT_EQ(18, shared.back());
+    EXPECT_EQ(20u, a.size());
+
+    std::vector<size_t> unsorted = {3, 2};
+    std::vector<size_t> outside = {25};
+    EXPECT_THROW(a.remove_indices(unsorted), std::runtime_error);
+    EXPECT_THROW(a.remove_indices(outside), std::runtime_error);
+    EXPECT_EQ(20u, a.size());
+    EXPECT_EQ(0u, a.remove_indices(std::vector<size_t>()));
+
+    container_int b = a;
+    container_int::iterator it = b.swap_erase(b.begin() + 2);
+    EXPECT_EQ(19, *it);
+    EXPECT_EQ(19u, b.size());
+    EXPECT_EQ(2, a[2]);
+    it = b.swap_erase(b.end() - 1);
+    EXPECT_EQ(b.end(), it);
+    EXPECT_EQ(17, b.back());
+}
+
+TEST(correctness, erase_if_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        container c;
+        for (int i = 0; i != 10; ++i)
+            c.push_back(i);
+        container shared = c;
+        try
+        {
+            erase_if(shared, [](counted const& x) { return (int) x % 3 == 0; });
+        }
+        catch (...)
+        {
+            EXPECT_EQ(10u, shared.size());
+            throw;
+        }
+        EXPECT_EQ(6u, shared.size());
+        EXPECT_EQ(1, (int) std::as_const(shared)[0]);
+        size_t indices[] = {0, 9};
+        try
+        {
+            c.remove_indices(indices);
+        }
+        catch (...)
+        {
+            for (size_t i = 1; i < c.size(); ++i)
+                EXPECT_LT((int) std::as_const(c)[i - 1], (int) std::as_const(c)[i]);
+            throw;
+        }
+        EXPECT_EQ(8u, c.size());
+        EXPECT_EQ(8, (int) std::as_const(c).back());
+    });
+}
+
+TEST(correctness, concurrent_vector_appends)
+{
+    concurrent_vector<int, 4> a;
+    size_t const per_thread = 5000;
+    std::atomic<bool> done{false};
+    std::thread reader([&]
+    {
+        while (!done.load())
+        {
+            size_t n = a.size();
+            for (size_t i = 0; i < n; i += 97)
+                if (a.is_published(i))
+                {
+                    EXPECT_LE(0, a[i]);
+                }
+        }
+    });
+    std::vector<std::thread> writers;
+    for (int t = 0; t != 4; ++t)
+        writers.emplace_back([&a, t, per_thread]
+        {
+            for (size_t i = 0; i != per_thread; ++i)
+            {
+                size_t index = a.push_back(t * 100000 + (int) i);
+                EXPECT_EQ(t * 100000 + (int) i, a[index]);
+            }
+        });
+    for (std::thread& w : writers)
+        w.join();
+    done.store(true);
+    reader.join();
+
+    EXPECT_EQ(4 * per_thread, a.size());
+    EXPECT_FALSE(a.is_published(a.size()));
+    EXPECT_THROW(a.at(a.size()), std::runtime_error);
+    container_int snapshot = a.snapshot();
+    EXPECT_EQ(a.size(), snapshot.size());
+    int last[4] = {-1, -1, -1, -1};
+    for (size_t i = 0; i != snapshot.size(); ++i)
+    {
+        int t = snapshot[i] / 100000;
+        EXPECT_LT(last[t], snapshot[i]);
+        last[t] = snapshot[i];
+    }
+    for (int t = 0; t != 4; ++t)
+        EXPECT_EQ(t * 100000 + (int) per_thread - 1, last[t]);
+}
+
+TEST(correctness, concurrent_vector_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        concurrent_vector<counted, 2> a;
+        for (int i = 0; i != 12; ++i)
+        {
+            try
+            {
+                a.emplace_back(i);
+            }
+            catch (...)
+            {
+                // a failed chunk claims nothing and a failed constructor leaves a
+                // dead slot; either way later appends still reach snapshot()
+                fault_injection_disable fd;
+                EXPECT_TRUE(a.size() == (size_t) i || !a.is_published(i));
+                a.emplace_back(-1);
+                container snapshot = a.snapshot();
+                EXPECT_EQ((size_t) i + 1, snapshot.size());
+                EXPECT_EQ(-1, (int) std::as_const(snapshot).back());
+                throw;
+            }
+        }
+        EXPECT_EQ(12u, a.size());
+        container snapshot = a.snapshot();
+        EXPECT_EQ(12u, snapshot.size());
+        for (size_t i = 0; i != 12; ++i)
+            EXPECT_EQ((int) i, (int) std::as_const(snapshot)[i]);
+    });
+
+    // a slot whose constructor threw stays dead and snapshot() skips it
+    concurrent_vector<flaky_copy, 2> b;
+    flaky_copy elems[] = {0, 1, 2, 3};
+    for (flaky_copy const& elem : elems)
+    {
+        flaky_copy::failures = elem.value == 2 ? 1 : 0;
+        if (elem.value == 2)
+            EXPECT_THROW(b.push_back(elem), std::runtime_error);
+        else
+            b.push_back(elem);
+    }
+    EXPECT_EQ(4u, b.size());
+    EXPECT_FALSE(b.is_published(2));
+    EXPECT_TRUE(b.is_published(3));
+    std::vector<flaky_copy> snapshot = b.snapshot<std::vector<flaky_copy>>();
+    ASSERT_EQ(3u, snapshot.size());
+    EXPECT_EQ(1, snapshot[1].value);
+    EXPECT_EQ(3, snapshot[2].value);
+}
+
+constexpr static_vector<int, 8> static_vector_squares()
+{
+    static_vector<int, 8> v;
+    for (int i = 0; i != 5; ++i)
+        v.push_back(i * i);
+    v.erase(v.begin());
+    v.insert(v.begin() + 2, 7);
+    erase_if(v, [](int x) { return x == 16; });
+    return v;
+}
+
+static_assert(static_vector_squares() == static_vector<int, 8>{1, 4, 7, 9});
+static_assert(static_vector_squares() < static_vector<int, 8>{1, 5});
+static_assert(sizeof(static_vector<uint8_t, 7>) == 8);
+
+TEST(correctness, static_vector_basics)
+{
+    static_vector<std::string, 4> a = {"b", "c"};
+    a.insert(a.begin(), "a");
+    a.emplace_back(2, 'd');
+    EXPECT_TRUE(a.full());
+    EXPECT_THROW(a.push_back("e"), std::length_error);
+    EXPECT_THROW(a.insert(a.begin(), "e"), std::length_error);
+    EXPECT_THROW(a.checked_at(4), std::runtime_error);
+    EXPECT_EQ(4u, a.size());
+    EXPECT_EQ("dd", a.back());
+
+    static_vector<std::string, 4> b = a;
+    EXPECT_EQ(a, b);
+    b.erase(b.begin() + 1, b.begin() + 3);
+    EXPECT_EQ(2u, b.size());
+    EXPECT_EQ("dd", b[1]);
+    EXPECT_LT(a, b);
+    a.swap(b);
+    EXPECT_EQ(2u, a.size());
+    EXPECT_EQ(4u, b.size());
+    EXPECT_EQ("c", b[2]);
+
+    static_vector<std::string, 4> c = std::move(b);
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(4u, c.size());
+    EXPECT_EQ("a", c.swap_erase(c.begin() + 3)[-3]);
+    c = a;
+    EXPECT_EQ(a, c);
+    c.erase(c.begin() + 1, c.begin() + 1);
+    EXPECT_EQ(a, c);
+    vector<std::string> v = c.to_vector();
+    EXPECT_EQ(2u, v.size());
+    EXPECT_EQ("a", v[0]);
+    c.pop_back();
+    c.pop_back();
+    EXPECT_THROW(c.pop_back(), std::runtime_error);
+}
+
+// Bigger trivial vectors leave unused slots unwritten instead of being literal types
+static_assert(std::is_trivially_copyable_v<static_vector<int, 16>>);
+static_assert(!std::is_trivially_copyable_v<static_vector<int, 4096>>);
+
+TEST(correctness, static_vector_large_trivial)
+{
+    static_vector<int, 4096> a;
+    for (int i = 0; i != 1000; ++i)
+        a.push_back(i);
+    static_vector<int, 4096> b = a;
+    EXPECT_EQ(a, b);
+    b.erase(b.begin(), b.begin() + 10);
+    EXPECT_EQ(990u, b.size());
+    EXPECT_EQ(10, b[0]);
+    a = b;
+    EXPECT_EQ(b, a);
+    static_vector<int, 4096> c = std::move(a);
+    EXPECT_TRUE(a.empty());
+    EXPECT_EQ(999, c.back());
+    c = c;
+    EXPECT_EQ(990u, c.size());
+    b = std::move(c);
+    EXPECT_TRUE(c.empty());
+    EXPECT_EQ(990u, b.size());
+    b.resize(4096, 7);
+    EXPECT_TRUE(b.full());
+    EXPECT_EQ(7, b.back());
+}
+
+TEST(correctness, static_vector_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        static_vector<counted, 6> a;
+        for (int i = 0; i != 4; ++i)
+            a.emplace_back(i);
+        static_vector<counted, 6> b = a;
+        try
+        {
+            b.insert(b.begin() + 1, counted(9));
+        }
+        catch (...)
+        {
+            EXPECT_GE(b.size(), 4u);
+            throw;
+        }
+        EXPECT_EQ(5u, b.size());
+        EXPECT_EQ(9, (int) b[1]);
+        EXPECT_EQ(3, (int) b.back());
+        b.swap(a);
+        EXPECT_EQ(4u, b.size());
+        a.resize(6, counted(1));
+        EXPECT_EQ(1, (int) a.back());
+    });
+}
+
+TEST(correctness, insert_range_into_shared)
+{
+    container_int a;
+    for (int i = 0; i != 10; ++i)
+        a.push_back(i);
+    container_int b = a;
+    int extra[] = {100, 101};
+    container_int::iterator it = b.insert(std::as_const(b).begin() + 3, std::begin(extra), std::end(extra));
+    EXPECT_EQ(100, *it);
+    EXPECT_EQ(12u, b.size());
+    EXPECT_EQ(2, b[2]);
+    EXPECT_EQ(3, b[5]);
+    container_int c = a;
+    c.insert(std::as_const(c).begin() + 1, 2, 7);
+    EXPECT_EQ(7, c[2]);
+    EXPECT_EQ(1, c[3]);
+    EXPECT_EQ(10u, a.size());
+}
+
+TEST(correctness, flat_set_bulk_insert)
+{
+    flat_set<long> a = {5, 1, 3, 3};
+    EXPECT_EQ(3u, a.size());
+    std::vector<long> batch = {9, 2, 5, 7, 2, 0};
+    a.insert(batch.begin(), batch.end());
+    std::vector<long> expected = {0, 1, 2, 3, 5, 7, 9};
+    EXPECT_TRUE(std::equal(a.begin(), a.end(), expected.begin(), expected.end()));
+    EXPECT_TRUE(a.insert(4).second);
+    EXPECT_FALSE(a.insert(4).second);
+    EXPECT_EQ(4, *a.find(4));
+    EXPECT_EQ(a.end(), a.find(6));
+    EXPECT_EQ(7, *a.lower_bound(6));
+    EXPECT_EQ(7, *a.upper_bound(5));
+    EXPECT_EQ(a.begin(), a.lower_bound(-1));
+    EXPECT_EQ(a.end(), a.upper_bound(9));
+    EXPECT_EQ(1u, a.erase(0));
+    EXPECT_EQ(0u, a.erase(0));
+    EXPECT_EQ(1, *a.begin());
+
+    for (size_t n = 0; n != 40; ++n)
+    {
+        vector<long> sorted;
+        for (size_t i = 0; i != n; ++i)
+            sorted.push_back(2 * (long) i);
+        flat_set<long> s(sorted_unique, sorted);
+        for (long key = -1; key <= 2 * (long) n; ++key)
+        {
+            EXPECT_EQ(std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin(), s.lower_bound(key) - s.begin());
+            EXPECT_EQ(key >= 0 && key % 2 == 0 && key < 2 * (long) n, s.contains(key));
+        }
+    }
+}
+
+TEST(correctness, flat_lookups_do_not_detach)
+{
+    flat_set<long> a;
+    for (long i = 0; i != 100; ++i)
+        a.insert(i * 3);
+    flat_set<long> snapshot = a;
+    vector_stats<long>::reset();
+    for (long i = 0; i != 300; ++i)
+        EXPECT_EQ(i % 3 == 0, snapshot.contains(i));
+    EXPECT_EQ(0u, vector_stats<long>::snapshot().detaches);
+    snapshot.insert({1, 2});
+    EXPECT_EQ(1u, vector_stats<long>::snapshot().detaches);
+    EXPECT_EQ(102u, snapshot.size());
+    EXPECT_EQ(100u, a.size());
+    EXPECT_FALSE(a.contains(1));
+
+    flat_map<int, std::string> m = {{3, "c"}, {1, "a"}, {3, "x"}};
+    EXPECT_EQ(2u, m.size());
+    EXPECT_EQ("c", m.at(3));
+    flat_map<int, std::string> copy = m;
+    EXPECT_TRUE(std::as_const(copy).sequence().shared());
+    EXPECT_EQ("a", std::as_const(copy).at(1));
+    EXPECT_TRUE(copy.find(2) == copy.end());
+    EXPECT_TRUE(std::as_const(copy).sequence().shared());
+    copy[2] = "b";
+    copy.at(1) = "z";
+    EXPECT_FALSE(copy.insert_or_assign(3, "y").second);
+    EXPECT_TRUE(copy.try_emplace(4, 2, 'd').second);
+    EXPECT_FALSE(copy.try_emplace(4, "e").second);
+    EXPECT_EQ("dd", copy.at(4));
+    EXPECT_EQ("y", copy.at(3));
+    EXPECT_EQ("a", m.at(1));
+    EXPECT_EQ(2u, m.size());
+    std::vector<std::pair<int, std::string>> batch = {{0, "0"}, {4, "no"}, {0, "dup"}};
+    copy.insert(batch.begin(), batch.end());
+    EXPECT_EQ(5u, copy.size());
+    EXPECT_EQ("0", copy.at(0));
+    EXPECT_EQ("dd", copy.at(4));
+    EXPECT_THROW(copy.at(9), std::runtime_error);
+}
+
+TEST(correctness, flat_set_exceptions)
+{
+    faulty_run([]
+    {
+        counted::no_new_instances_guard g;
+        flat_set<counted, std::less<counted>, container> a;
+        for (int i = 0; i != 6; ++i)
+            a.insert(counted(i * 2));
+        flat_set<counted, std::less<counted>, container> b = a;
+        std::vector<counted> batch = {counted(7), counted(1), counted(4)};
+        try
+        {
+            b.insert(batch.begin(), batch.end());
+        }
+        catch (...)
+        {
+            EXPECT_EQ(6u, b.size());
+            throw;
+        }
+        EXPECT_EQ(8u, b.size());
+        EXPECT_EQ(6u, a.size());
+        EXPECT_TRUE(std::is_sorted(b.begin(), b.end()));
+    });
+}
+
+template<typename T>
+static void check_packed(std::vector<T> const& values)
+{
+    packed_vector<T> p(values.begin(), values.end());
+    ASSERT_EQ(values.size(), p.size());
+    for (size_t i = 0; i != values.size(); ++i)
+        ASSERT_EQ(values[i], p[i]) << i;
+    EXPECT_TRUE(std::equal(p.begin(), p.end(), values.begin(), values.end()));
+    vector<T> out;
+    out.push_back(1);
+    p.decompress_into(out);
+    EXPECT_TRUE(std::equal(out.begin(), out.end(), values.begin(), values.end()));
+    size_t seen = 0;
+    p.for_each_block([&](T const* first, size_t n)
+    {
+        EXPECT_TRUE(std::equal(first, first + n, values.begin() + seen));
+        seen += n;
+    });
+    EXPECT_EQ(values.size(), seen);
+}
+
+TEST(correctness, packed_vector_roundtrip)
+{
+    std::mt19937_64 rng(7);
+    for (size_t n : {0, 1, 127, 128, 129, 1000})
+    {
+        for (unsigned bits : {0u, 1u, 5u, 17u, 31u, 32u, 33u, 63u, 64u})
+        {
+            std::vector<uint64_t> wide;
+            std::vector<uint32_t> narrow;
+            for (size_t i = 0; i != n; ++i)
+            {
+                uint64_t r = bits == 64 ? rng() : rng() & ((uint64_t(1) << bits) - 1);
+                wide.push_back(r + 1000);
+                narrow.push_back((uint32_t) (bits >= 32 ? rng() : r));
+            }
+            check_packed(wide);
+            check_packed(narrow);
+        }
+    }
+    EXPECT_THROW(packed_vector<uint32_t>({1, 2}).checked_at(2), std::runtime_error);
+
+    for (unsigned bits = 1; bits <= 32; ++bits)
+    {
+        uint32_t values[packed_codec::block_size];
+        for (uint32_t& v : values)
+            v = 5 + ((uint32_t) rng() & packed_codec::low_mask<uint32_t>(bits));
+        std::vector<uint32_t> words(packed_codec::block_words<uint32_t>(bits));
+        packed_codec::encode(values, 5u, bits, words.data());
+        uint32_t simd[packed_codec::block_size];
+        uint32_t scalar[packed_codec::block_size];
+        packed_codec::decode(words.data(), 5u, bits, simd);
+        packed_codec::decode_scalar(words.data(), 5u, bits, scalar);
+        EXPECT_TRUE(std::equal(std::begin(simd), std::end(simd), std::begin(scalar)));
+    }
+}
+
+TEST(correctness, packed_vector_shares_and_shrinks)
+{
+    vector<uint32_t> ids;
+    for (uint32_t i = 0; i != 100000; ++i)
+        ids.push_back(1000000 + i * 3 + (i & 1));
+    packed_vector<uint32_t> p(ids);
+    EXPECT_LT(p.packed_bytes() * 3, ids.size() * sizeof(uint32_t));
+    EXPECT_EQ(ids.back(), p.back());
+    vector_stats<uint32_t>::reset();
+    packed_vector<uint32_t> copy = p;
+    EXPECT_EQ(0u, vector_stats<uint32_t>::snapshot().allocations);
+    EXPECT_TRUE(copy == p);
+    EXPECT_EQ(ids, copy.decompress());
+    packed_vector<uint32_t> other({1, 2, 3});
+    EXPECT_TRUE(other != p);
+    swap(other, copy);
+    EXPECT_EQ(3u, copy.size());
+    EXPECT_EQ(ids.size(), other.size());
+}
+
+static void check_numa_ranges(vector<numa_range> const& ranges, size_t n)
+{
+    ASSERT_FALSE(ranges.empty());
+    EXPECT_EQ(0u, ranges[0].first);
+    EXPECT_EQ(n, ranges.back().last);
+    for (size_t i = 0; i != ranges.size(); ++i)
+    {
+        EXPECT_LT(ranges[i].first, ranges[i].last);
+        EXPECT_GE(ranges[i].node, 0);
+        if (i != 0)
+        {
+            EXPECT_EQ(ranges[i - 1].last, ranges[i].first);
+            EXPECT_NE(ranges[i - 1].node, ranges[i].node);
+        }
+    }
+}
+
+TEST(correctness, numa_placement)
+{
+    typedef vector<int, 1, plain_ref_count, numa_allocator<int, 4096>> numa_vector;
+    size_t const n = 300000;
+    EXPECT_GE(numa_node_count(), 1u);
+    for (numa_mode mode : {numa_first_touch, numa_interleave, numa_bind})
+    {
+        numa_vector v{numa_allocator<int, 4096>(mode)};
+        for (size_t i = 0; i != n; ++i)
+            v.push_back((int) i);
+        check_numa_ranges(numa_ranges(v), n);
+        EXPECT_EQ(299999, v.back());
+    }
+
+    vector_parallel::thread_limit = 3;
+    numa_vector touched{numa_allocator<int, 4096>(numa_first_touch)};
+    parallel_resize(touched, n, 7);
+    vector_parallel::thread_limit = 0;
+    check_numa_ranges(numa_ranges(touched), n);
+    EXPECT_EQ(7, touched.const_span()[n - 1]);
+
+    numa_allocator<int, 4096> alloc(numa_first_touch);
+    int* raw = alloc.allocate(n);
+    raw[0] = 1;
+    vector<numa_range> ranges = numa_ranges(span<int const>(raw, n));
+    ASSERT_GE(ranges.size(), 2u);
+    EXPECT_GE(ranges[0].node, 0);
+    EXPECT_EQ(-1, ranges.back().node);
+    EXPECT_EQ(n, ranges.back().last);
+    alloc.deallocate(raw, n);
+
+    numa_allocator<int, 4096> bad(numa_bind, -1);
+    EXPECT_THROW(bad.allocate(n), std::system_error);
+    EXPECT_TRUE(numa_ranges(span<int const>()).empty());
+}
+
 TEST(exceptions, nothrow_default_ctor)
 {
     faulty_run([]